@@ -28,6 +28,9 @@
 #define TEXTCAT_H
 
 #include <cstring>
+#include <string>
+#include <vector>
+#include <mutex>
 
 #ifdef HAVE_TEXTCAT
   #ifdef HAVE_OLD_TEXTCAT
@@ -44,20 +47,25 @@ extern "C" {
 #endif
 
 class TextCat {
+  // guesses the language of a text. The fingerprints are loaded on the
+  // first guess. One TextCat may be shared by any number of threads.
  public:
-  explicit TextCat( const std::string&, TiCC::LogStream * =0 );
+  explicit TextCat( const std::string& );
   TextCat( const TextCat& );
   ~TextCat();
-  bool isInit() const { return TC != 0; };
-  std::string get_language( const std::string& ) const;
-  std::vector<std::string> get_languages( const std::string& ) const;
-  bool set_debug( bool );
-  void set_debug_stream( TiCC::LogStream *s ){ dbg = s; };
+  // the guessed languages of a text, best first. The guessing is logged
+  // to the stream, when given
+  std::string get_language( const std::string&,
+			    TiCC::LogStream * =0 ) const;
+  std::vector<std::string> get_languages( const std::string&,
+					  TiCC::LogStream * =0 ) const;
  private:
-  void *TC;
+  TextCat& operator=( const TextCat& ); // inhibit copies
+  void init() const;
+  mutable void *TC;
   std::string cfName;
-  bool debug;
-  TiCC::LogStream *dbg;
+  // textcat_Classify() uses a buffer of TC, so one guess at a time
+  mutable std::mutex guess_mutex;
 };
 
 #endif // TEXTCAT_H
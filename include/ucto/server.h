@@ -0,0 +1,123 @@
+/*
+  Copyright (c) 2006 - 2021
+  CLST - Radboud University
+  ILK  - Tilburg University
+
+  This file is part of Ucto
+
+  Ucto is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Ucto is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ucto/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef UCTO_SERVER_H
+#define UCTO_SERVER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include "ucto/tokenize.h"
+
+namespace Tokenizer {
+
+  struct Request {
+    // one tokenization request: a text, with options for this text only
+    std::string id;
+    std::vector<std::string> options;
+    std::string text;
+  };
+
+  // the largest request text we accept, unless told otherwise
+  const size_t default_max_request = 16 * 1024 * 1024;
+
+  class RequestChannel {
+    // reads requests from a file descriptor, and writes the responses to
+    // another (or the same) one.
+    // A request is a line '<id> <length> [option]...' followed by <length>
+    // bytes of UTF-8 text. With '-' for <length>, the text runs up to the
+    // next NUL byte.
+    // A response is a line '<id> OK <length>' followed by <length> bytes of
+    // output, or a line '<id> ERROR <message>'
+    // Requests with a text larger than max are refused. With a timeout
+    // (in seconds) the other side gets that long to send a whole request,
+    // and to take a whole response. Otherwise we wait as long as it takes
+  public:
+    RequestChannel( int in, int out,
+		    size_t max = default_max_request, int timeout = 0 );
+    // get the next request. false at the end of the input.
+    // throws a runtime_error on a malformed, too large or too slow request
+    bool read( Request& );
+    // is there input read already that no request used yet?
+    bool buffered() const { return pos < buffer.size(); };
+    bool write_output( const std::string&, const std::string& );
+    bool write_error( const std::string&, const std::string& );
+  private:
+    RequestChannel( const RequestChannel& ); // inhibit copies
+    RequestChannel& operator=( const RequestChannel& ); // inhibit copies
+    bool fill();
+    bool write( const std::string& );
+    void start_clock();
+    bool wait( int, short );
+    int in_fd;
+    int out_fd;
+    bool out_socket; // then we send() without raising SIGPIPE
+    size_t max_request;
+    int timeout;
+    std::chrono::steady_clock::time_point deadline;
+    std::string buffer; // read from in_fd, from pos on not used yet
+    size_t pos;
+  };
+
+  class TokenizerServer {
+    // serves tokenization requests over a Unix domain socket or a TCP port
+    // on localhost. A pool of worker threads handles the requests, each
+    // worker with its own session, so all of them share one model.
+    // Connections are handed to a worker per request, so an idle
+    // connection doesn't keep a worker busy.
+  public:
+    // creates a session with the options of the server, one for every
+    // worker. The server deletes them when run() returns
+    typedef std::function<TokenizerClass*()> SessionFactory;
+    // a factory, the number of workers, and the largest request text
+    TokenizerServer( const SessionFactory&, size_t,
+		     size_t = default_max_request );
+    ~TokenizerServer();
+    void listen_unix( const std::string& );
+    void listen_tcp( int );
+    // accept connections, until the listening socket fails
+    void run();
+    // handle all requests on a channel with session
+    static void serve( RequestChannel&, TokenizerClass& );
+    // handle the next request on a channel with session. false when there
+    // are no more requests on the channel, or it failed
+    static bool serve_one( RequestChannel&, TokenizerClass& );
+    // tokenize the text of a request, with its options, and return the
+    // output. Throws an invalid_argument on unknown options
+    static std::string handle( TokenizerClass&, const Request& );
+  private:
+    TokenizerServer( const TokenizerServer& ); // inhibit copies
+    TokenizerServer& operator=( const TokenizerServer& ); // inhibit copies
+    SessionFactory factory;
+    size_t workers;
+    size_t max_request;
+    int listen_fd;
+    std::string socket_path; // removed again by the destructor
+  };
+
+}
+#endif
@@ -27,9 +27,12 @@
 #ifndef UCTO_SETTING_H
 #define UCTO_SETTING_H
 
+#include <unordered_map>
+#include "unicode/regex.h"
+#include "unicode/uniset.h"
+
 namespace TiCC {
   class LogStream;
-  class UnicodeRegexMatcher;
   class UniFilter;
 }
 
@@ -37,25 +40,149 @@ namespace Tokenizer {
 
   using namespace icu;
 
+  class AbbreviationTrie {
+    // the entries of the [ABBREVIATIONS], in their regex form, in order.
+    // The plain literal entries are also stored in a trie, as they are and
+    // case folded, to find the entries that match at some position.
+  public:
+    AbbreviationTrie(): full_folds(false) {
+      exact.resize(1);
+      folded.resize(1);
+    };
+    void add( const UnicodeString& );
+    size_t size() const { return entries.size(); };
+    bool empty() const { return entries.empty(); };
+    // true when every entry is a plain literal
+    bool literal() const { return always.empty(); };
+    // true when an entry has a character with a multi character case
+    // folding, which the trie can't match caseless
+    bool hasFullFolds() const { return full_folds; };
+    UnicodeString alternation() const;
+    void matches( const UnicodeString&, int, bool,
+		  std::vector<std::pair<int,int>>& ) const;
+  private:
+    struct Node {
+      std::map<UChar,int> next;
+      std::vector<int> ends; // the entries ending in this node
+    };
+    static void insert( std::vector<Node>&, const UnicodeString&, int );
+    std::vector<Node> exact;
+    std::vector<Node> folded;
+    std::vector<UnicodeString> entries;
+    std::vector<int> always; // the entries that are not plain literals
+    bool full_folds;
+  };
+
+  struct MatchSpan {
+    // a part of the input of a match: [start, start+length)
+  MatchSpan(): start(0), length(0){};
+  MatchSpan( int32_t s, int32_t l ): start(s), length(l){};
+    int32_t start;
+    int32_t length;
+  };
+
+  struct RuleMatch {
+    // the result of a Rule match, as offsets into the input.
+    // The same parts Rule::matchAll() returns as copies.
+    MatchSpan pre;
+    MatchSpan post;
+    std::vector<MatchSpan> groups;
+    void clear() { pre = MatchSpan(); post = MatchSpan(); groups.clear(); };
+  };
+
   class Rule {
+    // a rule of the configuration, with its compiled pattern.
+    // A Rule is not changed after construction. The matching itself is
+    // done by a RuleMatcher, so one Rule can be used in several threads.
     friend std::ostream& operator<< (std::ostream&, const Rule& );
+    friend class RuleMatcher;
   public:
-  Rule(): regexp(0){
+  Rule(): regex(0), lookup(0), prefix_regex(0), suffix_regex(0),
+      caseless(false), prefix_groups(0), min_length(0){
     };
     Rule( const UnicodeString& id, const UnicodeString& pattern);
+    Rule( const UnicodeString& id,
+	  const UnicodeString& prefix,
+	  const AbbreviationTrie&,
+	  const UnicodeString& suffix );
     ~Rule();
     UnicodeString id;
     UnicodeString pattern;
-    TiCC::UnicodeRegexMatcher *regexp;
+    bool isLookup() const { return lookup != 0; };
+    bool mayMatch( const UnicodeString& ) const;
+    bool excludes( const UnicodeSet& ) const;
+  private:
+    RegexPattern *regex;
+    // for a rule like prefix(% ABBREVIATIONS %)suffix, where the
+    // abbreviations form a group of their own, we look the abbreviations up
+    // in the trie, and only use regexes for the prefix and the suffix.
+    const AbbreviationTrie *lookup; // 0 when that is not possible
+    bool split_lookup( const UnicodeString&, const UnicodeString& );
+    RegexPattern *prefix_regex; // the prefix, anchored at its end
+    RegexPattern *suffix_regex; // the suffix, with the groups it closes
+    bool caseless;              // the abbreviations match case insensitive
+    int prefix_groups;          // the number of groups opened in the prefix
+    // the numbers of the groups that the prefix opens and the suffix
+    // closes, outermost first
+    std::vector<int> open_groups;
+    void build_prefilter();
+    // a cheap necessary condition for the pattern to match:
+    // the input has at least min_length characters AND
+    // for each set in required, at least 1 character from that set.
+    int min_length;
+    std::vector<UnicodeSet> required;
+    Rule( const Rule& ); // inhibit copies
+    Rule& operator=( const Rule& ); // inhibit copies
+  };
+
+  class RuleMatcher {
+    // matches the input against a Rule. An ICU RegexMatcher holds the state
+    // of its last match, so every TokenizerClass has its own RuleMatcher,
+    // on the shared compiled patterns.
+  public:
+    explicit RuleMatcher( const Rule& );
+    ~RuleMatcher();
+    const Rule& rule;
     bool matchAll( const UnicodeString&,
 		   UnicodeString&,
 		   UnicodeString&,
 		   std::vector<UnicodeString>& );
+    bool match( const UnicodeString&, RuleMatch& );
+    bool find( const UnicodeString& );
+    size_t tried;   // the number of times the regex was run
+    size_t skipped; // the number of times mayMatch() saved us a regex run
   private:
-    Rule( const Rule& ); // inhibit copies
-    Rule& operator=( const Rule& ); // inhibit copies
+    int lookup_match( const UnicodeString&, bool );
+    RegexMatcher *matcher; // on the pattern of rule
+    RegexMatcher *prefix;  // for a lookup rule
+    RegexMatcher *suffix;  // for a lookup rule
+    // scratch space
+    std::vector<std::pair<int,int>> hits;
+    std::vector<std::pair<int,int>> goods;
+    std::vector<std::pair<int,int>> spans;
+    RuleMatcher( const RuleMatcher& ); // inhibit copies
+    RuleMatcher& operator=( const RuleMatcher& ); // inhibit copies
   };
 
+  class RuleMatchers {
+    // matchers for all RULES of a Setting, in RULE-ORDER. They are still
+    // tried one by one, but a Rule whose prefilter rules out the input is
+    // skipped. A match yields the first Rule that matches.
+  public:
+    explicit RuleMatchers( const std::vector<Rule *>& );
+    ~RuleMatchers();
+    const Rule *matchFirst( const UnicodeString&,
+			    UnicodeString&,
+			    UnicodeString&,
+			    std::vector<UnicodeString>& );
+    const Rule *matchFirst( const UnicodeString&, RuleMatch& );
+    bool matchesAny( const UnicodeString&, const std::vector<size_t>& );
+    const std::vector<RuleMatcher *>& matchers() const { return _matchers; };
+  private:
+    RuleMatchers( const RuleMatchers& ); // inhibit copies
+    RuleMatchers& operator=( const RuleMatchers& ); // inhibit copies
+    std::vector<RuleMatcher *> _matchers;
+  };
 
   class Quoting {
     friend std::ostream& operator<<( std::ostream&, const Quoting& );
@@ -67,49 +194,117 @@ namespace Tokenizer {
     void add( const UnicodeString&, const UnicodeString& );
     UnicodeString lookupOpen( const UnicodeString &) const;
     UnicodeString lookupClose( const UnicodeString & ) const;
+    int openPair( UChar32 ) const;
+    int closePair( UChar32 ) const;
+    const UnicodeString& openQuote( int i ) const {
+      return _quotes[i].openQuote;
+    };
+    UnicodeString characters() const;
     bool empty() const { return _quotes.empty(); };
-    bool emptyStack() const { return quotestack.empty(); };
-    void clearStack() { quoteindexstack.clear(); quotestack.clear(); };
-    int lookup( const UnicodeString&, int& );
+  private:
+    std::vector<QuotePair> _quotes;
+    std::unordered_map<UChar32,int> open_index;  // character -> pair
+    std::unordered_map<UChar32,int> close_index; // character -> pair
+  };
+
+  class QuoteStack {
+    // the opening quotes that are not resolved yet.
+    // Stored as the absolute token index (see TokenizerClass::tokens_offset)
+    // and the character of every unresolved opening quote
+  public:
+    bool empty() const { return quotestack.empty(); };
+    // the absolute token index of the oldest unresolved quote.
+    // Only valid when the stack isn't empty
+    size_t oldestOpen() const { return quoteindexstack.front(); };
+    void clear() { quoteindexstack.clear(); quotestack.clear(); };
+    bool lookup( const UnicodeString&, int&, size_t& ) const;
     void eraseAtPos( int pos ) {
       quotestack.erase( quotestack.begin()+pos );
       quoteindexstack.erase( quoteindexstack.begin()+pos );
     }
-    void flushStack( int ); //renamed from eraseBeforeIndex
-    void push( int i, UChar32 c ){
+    void flushStack( size_t ); //renamed from eraseBeforeIndex
+    void push( size_t i, UChar32 c ){
       quoteindexstack.push_back(i);
       quotestack.push_back(c);
     }
   private:
-    std::vector<QuotePair> _quotes;
-    std::vector<int> quoteindexstack;
+    std::vector<size_t> quoteindexstack;
     std::vector<UChar32> quotestack;
   };
 
+  class CharTable {
+    // the character classes the tokenizer asks for, per code point.
+    // A table for the BMP, computed once. Other code points are
+    // classified on the fly.
+  public:
+    enum CharFlag {
+      SPACE       = 1,
+      PUNCT       = 2,
+      DIGIT       = 4,
+      ALPHA       = 8,
+      QUOTE       = 16,
+      EMOTICON    = 32,
+      PICTO       = 64,
+      CURRENCY    = 128,
+      SYMBOL      = 256,
+      UPPER       = 512,  // uppercase or titlecase
+      CASED_BLOCK = 1024  // in a block of a script that distinguishes case
+    };
+  CharTable(): quotes(0){};
+    void build( const Quoting& );
+    uint16_t flags( UChar32 c ) const {
+      if ( c >= 0 && c < 0x10000 && !table.empty() ){
+	return table[c];
+      }
+      return classify( c );
+    };
+    bool is( UChar32 c, uint16_t f ) const { return (flags( c ) & f) != 0; };
+  private:
+    uint16_t classify( UChar32 ) const;
+    std::vector<uint16_t> table;
+    const Quoting *quotes;
+  };
+
   class Setting {
+    // the configuration for one language. After read() it isn't changed
+    // anymore, so it may be shared between threads. (see TokenizerModel)
   public:
+  Setting(): letter_path(false){};
     ~Setting();
+    // the debug level and the log are only used during the call. A Setting
+    // doesn't keep them, so it never logs to a stream of another thread
     bool read( const std::string&, const std::string&, int, TiCC::LogStream* );
-    bool readrules( const std::string& );
-    bool readfilters( const std::string& );
-    bool readquotes( const std::string& );
-    bool readeosmarkers( const std::string& );
-    bool readabbreviations( const std::string&,  UnicodeString& );
+    bool readrules( const std::string&, int, TiCC::LogStream* );
+    bool readfilters( const std::string&, int, TiCC::LogStream* );
+    bool readquotes( const std::string&, int, TiCC::LogStream* );
+    bool readeosmarkers( const std::string&, int, TiCC::LogStream* );
+    bool readabbreviations( const std::string&,  UnicodeString&,
+			    int, TiCC::LogStream* );
     void add_rule( const UnicodeString&,
 		   const std::vector<UnicodeString>& );
+    void add_lookup_rule( const UnicodeString&,
+			  const std::vector<UnicodeString>&,
+			  const std::vector<UnicodeString>& );
     void sortRules( std::map<UnicodeString, Rule *>&,
-		    const std::vector<UnicodeString>& );
+		    const std::vector<UnicodeString>&,
+		    TiCC::LogStream* );
+    void find_letter_rules( int, TiCC::LogStream* );
     static std::set<std::string> installed_languages();
     UnicodeString eosmarkers;
     std::vector<Rule *> rules;
     std::map<UnicodeString, Rule *> rulesmap;
     std::map<UnicodeString, int> rules_index;
+    AbbreviationTrie abbreviations;
+    // words of only letters are just a WORD, unless one of the
+    // letter_rules matches. (only when letter_path is true)
+    bool letter_path;
+    UnicodeSet letters;
+    std::vector<size_t> letter_rules;
     Quoting quotes;
+    CharTable chars;
     TiCC::UniFilter filter;
     std::string set_file; // the name of the settingsfile
     std::string version;  // the version of the datafile
-    int tokDebug;
-    TiCC::LogStream *theErrLog;
   };
 
 } // namespace Tokenizer
@@ -30,8 +30,12 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <list>
+#include <deque>
+#include <unordered_map>
 #include <sstream>
 #include <stdexcept>
+#include <functional>
 #include "libfolia/folia.h"
 #include "ticcutils/LogStream.h"
 #include "ticcutils/Unicode.h"
@@ -100,16 +104,120 @@ namespace Tokenizer {
     std::string typetostring();
   };
 
+  class WordCache {
+    // a bounded LRU cache, storing the tokens that tokenizeWord produced
+    // for a word, in a certain context
+  public:
+    struct Key {
+      // a word, and the context that decides what tokenizeWord makes of it
+      UnicodeString word;
+      UnicodeString type; // the type assigned to it beforehand, if any
+      bool space;         // a space follows
+      std::string lang;
+      bool operator==( const Key& k ) const {
+	return space == k.space && word == k.word
+	  && type == k.type && lang == k.lang;
+      };
+    };
+    struct Result {
+      std::vector<Token> tokens;
+      bool clears_nospace; // the NOSPACE role of the token before is removed
+    };
+    explicit WordCache( size_t size ): hits(0), misses(0), max_size(size) {};
+    const Result *lookup( const Key& );
+    void store( const Key&, const Result& );
+    void clear() { entries.clear(); index.clear(); };
+    void resize( size_t );
+    size_t capacity() const { return max_size; };
+    size_t size() const { return entries.size(); };
+    size_t hits;
+    size_t misses;
+  private:
+    struct hash_key {
+      size_t operator()( const Key& k ) const {
+	size_t h = k.word.hashCode();
+	h = h * 31 + k.type.hashCode();
+	h = h * 31 + std::hash<std::string>()( k.lang );
+	return h * 2 + k.space;
+      }
+    };
+    typedef std::pair<Key,Result> entry;
+    size_t max_size;
+    std::list<entry> entries; // most recently used first
+    std::unordered_map<Key,
+		       std::list<entry>::iterator,
+		       hash_key> index;
+  };
+
+  // the helpers of the pipeline, see src/pipeline.h
+  class LineReader;
+  class Utf8Writer;
+  struct ParagraphChunk;
+  template <typename T> class RingBuffer;
+
+  class TokenizerModel {
+    // the Settings for one or more languages, read from the configuration
+    // files, with all their rules compiled.
+    // A model is not changed after init(), so one model may be shared by
+    // any number of TokenizerClass sessions, also in different threads.
+  public:
+    TokenizerModel();
+    ~TokenizerModel();
+    bool init( const std::string&,
+	       const std::string&,
+	       TiCC::LogStream *,
+	       int = 0 ); // init from a configfile
+    bool init( const std::vector<std::string>&,
+	       const std::string&,
+	       TiCC::LogStream *,
+	       int = 0 ); // init 1 or more languages
+    // the Settings per language. "default" is an alias for the default
+    // language
+    const std::map<std::string,Setting*>& settings() const { return _settings; };
+    const std::string& default_language() const { return _default_language; };
+    bool get_setting_info( const std::string&,
+			   std::string&,
+			   std::string& ) const;
+    // for language detection, shared by all sessions. 0 without TextCat
+    const TextCat *textcat() const { return text_cat; };
+  private:
+    TokenizerModel( const TokenizerModel& ); // inhibit copies
+    TokenizerModel& operator=( const TokenizerModel& ); // inhibit copies
+    std::map<std::string,Setting*> _settings;
+    std::string _default_language;
+    TextCat *text_cat;
+  };
+
+  class SentenceSink {
+    // receives the sentences of TokenizerClass::tokenize( istream&, sink )
+    // one by one, as soon as they are found
+  public:
+    virtual ~SentenceSink() {};
+    // the next sentence. The tokens are only valid during the call
+    virtual void sentence( const std::vector<Token>& ) = 0;
+    // the next sentence starts a new paragraph
+    virtual void paragraph() {};
+    // the end of the input. No sentences follow
+    virtual void end_of_document() {};
+  };
+
   class TokenizerClass{
+    // A TokenizerClass is a tokenizer session: it holds the options and all
+    // the state of a tokenization run, on top of a TokenizerModel. Either
+    // its own model, created by init( configfile ), or a shared one.
+    // Every thread needs its own session.
   protected:
     int linenum;
   public:
     TokenizerClass();
-    ~TokenizerClass();
+    virtual ~TokenizerClass();
     bool init( const std::string&,
 	       const std::string& ="" ); // init from a configfile
     bool init( const std::vector<std::string>&,
 	       const std::string& ="" ); // init 1 or more languages
+    // use a shared model. It must outlive this session
+    bool init( const TokenizerModel * );
+    const TokenizerModel *getModel() const { return model; };
     bool reset( const std::string& = "default" );
     void setErrorLog( TiCC::LogStream *os );
 
@@ -125,15 +233,55 @@ namespace Tokenizer {
     // Tokenize from an input text stream to a token vector
     // (representing a sentence)
     // non greedy. Stops after the first full sentence is returned.
-    // may be called multiple times until EOF
+    // may be called multiple times, until it returns an empty vector.
+    // (the stream itself is read ahead, so it may hit EOF earlier)
     std::vector<Token> tokenizeOneSentence( std::istream& );
 
     // tokenize from file to file
     void tokenize( const std::string&, const std::string& );
 
+    // tokenize from file to an output stream. Regular files are memory mapped
+    void tokenize( const std::string&, std::ostream& );
+
     //Tokenize from input stream to output stream
     void tokenize( std::istream&, std::ostream& );
 
+    // Tokenize from an input text stream, and hand every sentence to sink.
+    // With paragraph detection, sink also hears where paragraphs start
+    void tokenize( std::istream&, SentenceSink& );
+
+    // tokenize a text file (or cin, when the name is empty) to an output
+    // stream, just like tokenize( file, OUT ), as a pipeline: a thread
+    // reads the input in chunks of lines, the tokenizer stages tokenize
+    // them, and the calling thread writes the results in order.
+    // Without helpers there is one stage, this session. Otherwise the input
+    // is split at empty lines into chunks of at least the given number of
+    // lines, which this session and the helpers tokenize in parallel.
+    // The helpers must have the same options as this session.
+    void tokenize_parallel( const std::string&,
+			    std::ostream&,
+			    const std::vector<TokenizerClass*>&,
+			    size_t = 1000 );
+
+    // changes the options of a session, see tokenizeBatch()
+    typedef std::function<void(TokenizerClass&)> BatchOptions;
+
+    // tokenize a batch of texts, each on its own, as if it was a file:
+    // result[i] gets the sentences of texts[i]. The vectors already in
+    // result are reused.
+    // With more than one thread, or with options, sessions on the model of
+    // this one, with the same options, do the work: one per thread, in
+    // parallel. options changes the options of those sessions, so for this
+    // batch only. This session itself is never changed.
+    void tokenizeBatch( const std::vector<std::string>&,
+			std::vector<std::vector<std::vector<Token>>>&,
+			size_t = 1,
+			const BatchOptions& = BatchOptions() );
+    std::vector<std::vector<std::vector<Token>>>
+      tokenizeBatch( const std::vector<std::string>&,
+		     size_t = 1,
+		     const BatchOptions& = BatchOptions() );
+
     // Tokenize a line (a line is NOT just a sentence, but an arbitrary string
     //                  of characters, inclusive EOS markers, Newlines etc.)
     //
@@ -174,6 +322,19 @@ namespace Tokenizer {
     bool setPassThru( bool b=true ) { bool t = passthru; passthru = b; return t; };
     bool getPassThru() const { return passthru; }
 
+    // match the RULES as spans of the input (default on). Off: the
+    // reference mode, which copies every match
+    bool setSpanMatching( bool b=true ) {
+      bool t = span_matching; span_matching = b; word_cache.clear(); return t;
+    };
+    bool getSpanMatching() const { return span_matching; }
+
+    // take the fast path for words made of letters only (default on)
+    bool setLetterPath( bool b=true ) {
+      bool t = letter_path; letter_path = b; word_cache.clear(); return t;
+    };
+    bool getLetterPath() const { return letter_path; }
+
     //Disable tag hints
     bool setNoTags( bool b=true ) { bool t = ignore_tag_hints;
       ignore_tag_hints = b;
@@ -196,6 +357,13 @@ namespace Tokenizer {
     bool setQuoteDetection( bool b=true ) { bool t = detectQuotes; detectQuotes = b; return t; }
     bool getQuoteDetection() const { return detectQuotes; }
 
+    //Give up on an opening quote when no closing quote is found within
+    // this many tokens (default 0: never give up)
+    size_t setQuoteLookback( size_t n ) {
+      size_t t = quote_lookback; quote_lookback = n; return t;
+    }
+    size_t getQuoteLookback() const { return quote_lookback; }
+
     //Enable language detection
     bool setLangDetection( bool b=true ) { bool t = doDetectLang; doDetectLang = b; return t; }
     bool getLangDetection() const { return doDetectLang; }
@@ -214,7 +382,7 @@ namespace Tokenizer {
 
     //Enable punctuation filtering
     bool setPunctFilter( bool b=true ) {
-      bool t = doPunctFilter; doPunctFilter = b; return t;
+      bool t = doPunctFilter; doPunctFilter = b; word_cache.clear(); return t;
     }
     bool getPunctFilter() const { return doPunctFilter; };
 
@@ -233,8 +401,17 @@ namespace Tokenizer {
     void setLanguage( const std::string& l ){ default_language = l; };
     std::string getLanguage() const { return default_language; };
 
+    // the language of text input, unless it is detected.
+    // "" means the default language of the model
+    std::string setTextLanguage( const std::string& l ) {
+      std::string t = text_language; text_language = l; return t; };
+    std::string getTextLanguage() const { return text_language; };
+
     // set eos marker
-    UnicodeString setEosMarker( const std::string& s = "<utt>") { UnicodeString t = eosmark; eosmark = TiCC::UnicodeFromUTF8(s); return t; };
+    UnicodeString setEosMarker( const std::string& s = "<utt>") {
+      UnicodeString t = eosmark; eosmark = TiCC::UnicodeFromUTF8(s);
+      word_cache.clear(); return t;
+    };
     UnicodeString getEosMarker( ) const { return eosmark; }
 
     bool setNormSet( const std::string& );
@@ -277,6 +454,15 @@ namespace Tokenizer {
 			   std::string& ) const;
     std::string get_data_version() const;
 
+    // print how often the RULES were tried, and skipped by their prefilter
+    void report_rule_stats( std::ostream& ) const;
+
+    // set the maximum number of words in the word cache. 0 disables it
+    size_t setWordCacheSize( size_t );
+    size_t getWordCacheSize() const { return word_cache.capacity(); };
+    // print the hits and misses of the word cache
+    void report_cache_stats( std::ostream& ) const;
+
     folia::processor *init_provenance( folia::Document *,
 				       folia::processor * =0 ) const;
     folia::processor *add_provenance_passthru( folia::Document *,
@@ -324,12 +510,77 @@ namespace Tokenizer {
     //Flush n sentences from buffer (does some extra validation as well)
 
     void outputTokens( std::ostream&, const std::vector<Token>& ,const bool continued=false) const; //continued should be set to true when outputTokens is invoked multiple times and it is not the first invokation
+    void outputTokens( Utf8Writer&, const std::vector<Token>&, const bool continued=false ) const;
     void add_rule( const UnicodeString&,
 		   const std::vector<UnicodeString>& );
     void tokenizeWord( const UnicodeString&,
 		       bool,
 		       const std::string&,
 		       const UnicodeString& ="" );
+    bool plain_word( const UnicodeString&, bool, const std::string& );
+    void internal_tokenize_word( const UnicodeString&,
+				 bool,
+				 const std::string&,
+				 const UnicodeString& ="" );
+    struct SettingState {
+      // the state of this session for one of the Settings of the model
+      explicit SettingState( const Setting *s ):
+	setting( s ), rules( s->rules ), filter( s->filter ) {};
+      const Setting *setting;
+      RuleMatchers rules;     // the matchers for the rules of setting
+      QuoteStack quotes;      // the unresolved quotes
+      TiCC::UniFilter filter; // a copy, as filtering isn't const
+    };
+    void set_model( const TokenizerModel *, bool );
+    bool check_model() const;
+    void clear_model();
+    const TextCat *textcat() const {
+      return model ? model->textcat() : 0;
+    };
+    void tokenize_word_part( const UnicodeString&,
+			     bool,
+			     const std::string&,
+			     const UnicodeString& );
+    struct WordPart {
+      // a part of a word, waiting to be handled by internal_tokenize_word()
+      enum Action { TOKENIZE, // run the rules on it (again)
+		    EMIT,     // add it as a Token
+		    SKIP      // a filtered punctuation
+      };
+    WordPart(): action(TOKENIZE), space(false) {};
+      Action action;
+      UnicodeString text;
+      UnicodeString type;
+      bool space;
+    };
+    struct ScanState {
+      // the state of countSentences() before token 'next'. All positions
+      // are absolute token numbers (see tokens_offset)
+    ScanState( size_t pos=0, bool temp=false ):
+      next(pos), quotelevel(0), begin(pos), temp_eos(temp) {};
+      size_t next;      // the first token not scanned yet
+      short quotelevel; // the quote level before token 'next'
+      size_t begin;     // the start of the current sentence
+      bool temp_eos;    // a TEMPENDOFSENTENCE outside quotes was skipped
+    };
+    struct SentenceScan : public ScanState {
+      // where countSentences() resumes, and some earlier states to go back
+      // to when the roles of the tokens before 'next' change
+      SentenceScan() { reset( 0 ); };
+      void reset( size_t pos ){
+	*static_cast<ScanState*>(this) = ScanState( pos );
+	ends.clear();
+	saved.assign( 1, ScanState( pos ) );
+      }
+      void rewind( size_t );
+      void forget( size_t );
+      std::deque<size_t> ends; // the ends of the sentences before 'next'
+      std::deque<ScanState> saved;
+    };
+    void push_word_part( WordPart::Action,
+			 const UnicodeString&,
+			 const UnicodeString&,
+			 bool );
     int internal_tokenize_line( const UnicodeString&,
 				const std::string& );
 
@@ -337,31 +588,79 @@ namespace Tokenizer {
 			    bool&,
 			    const std::string& = "" );
 
-    bool detectEos( size_t, const UnicodeString&, const Quoting& ) const;
+    bool detectEos( size_t, const Setting& ) const;
     void detectSentenceBounds( const int offset,
 			       const std::string& = "default" );
     void detectQuotedSentenceBounds( const int offset,
 				     const std::string& = "default" );
     void detectQuoteBounds( const int,
-			    Quoting& );
+			    SettingState& );
+    void abandonQuotes( const int, SettingState& );
 
-    bool resolveQuote( int, const UnicodeString&, Quoting& );
+    bool resolveQuote( int, const UnicodeString&, SettingState& );
     bool u_isquote( UChar32,
-		    const Quoting& ) const;
-    std::string checkBOM( std::istream& );
+		    const Setting& ) const;
     void outputTokensDoc_init( folia::Document& ) const;
+    void attach( std::istream& );
+    bool attach( const std::string& );
+    bool next_line( UnicodeString& );
+    std::vector<Token> next_sentence();
+    bool next_sentence( std::vector<Token>& );
+    bool pop_sentence( std::vector<Token>& );
+    folia::Document *sentences_to_folia();
+    void sentences_to_stream( std::ostream& );
+    typedef RingBuffer<ParagraphChunk> ChunkQueue;
+    typedef std::deque<ChunkQueue> ChunkQueues; // one for every stage
+    bool parallel_ok() const;
+    void tokenize_chunk( ParagraphChunk& );
+    void read_chunks( ChunkQueues&, size_t, bool );
+    void tokenize_paragraphs( ChunkQueue&, ChunkQueue& );
+    void tokenize_lines( ChunkQueue&, ChunkQueue& );
+    void write_chunks( ChunkQueues&, Utf8Writer& );
+    void tokenize_text( const std::string&,
+			std::vector<std::vector<Token>>& );
+    void copy_options( const TokenizerClass& );
 
     TiCC::UnicodeNormalizer normalizer;
     std::string inputEncoding;
+    bool utf8_input; // inputEncoding is UTF-8, in one of its spellings
 
     UnicodeString eosmark;
-    std::vector<Token> tokens;
+    // the input stream tokenizeOneSentence() is reading
+    LineReader *reader;
+    // the lines tokenize_chunk() is reading, instead of reader
+    const std::vector<UnicodeString> *chunk_lines;
+    size_t chunk_pos;
+    // where tokenize_lines() gets the next chunk, when chunk_lines is done
+    ChunkQueue *chunk_source;
+    ParagraphChunk *source_chunk;
+    // the token buffer. Sentences are taken from the front
+    std::deque<Token> tokens;
+    // the number of tokens taken from the buffer so far. So tokens[i] is
+    // token number tokens_offset+i of the input. Used for quote positions
+    size_t tokens_offset;
+    SentenceScan scan;
+    // the tokens with a BEGINQUOTE, ENDQUOTE or NEWPARAGRAPH role. Inside a
+    // quote, countSentences() and resolveQuote() only look at these
+    std::set<size_t> quote_marks;
     std::set<UnicodeString> norm_set;
+    WordCache word_cache;
+    // work stack and scratch space for internal_tokenize_word()
+    std::vector<WordPart> word_stack;
+    RuleMatch part_match;
+    UnicodeString part_pre;
+    UnicodeString part_post;
+    std::vector<UnicodeString> part_matches;
     TiCC::LogStream *theErrLog;
 
     std::string default_language;
     std::string document_language; // in case of an input FoLiA document
-    std::map<std::string,Setting*> settings;
+    std::string text_language; // see setTextLanguage()
+    const TokenizerModel *model;
+    bool own_model; // model was created by init(), and is deleted with us
+    // the state per language, like the settings of the model.
+    // Aliases share their state
+    std::map<std::string,SettingState*> settings;
     std::string _command; // original commandline
     //debug flag
     int tokDebug;
@@ -372,6 +671,9 @@ namespace Tokenizer {
     //detect quotes?
     bool detectQuotes;
 
+    //the maximum distance between an opening and a closing quote (0: any)
+    size_t quote_lookback;
+
     //filter special characters (default on)
     bool doFilter;
 
@@ -393,6 +695,7 @@ namespace Tokenizer {
 
     //has do we attempt to assign languages?
     bool doDetectLang;
+    bool tc_debug; // log the language detection
 
     //has do we percolate text up from <w> to <s> and <p> nodes? (FoLiA)
     // values should be: 'full', 'minimal' or 'none'
@@ -408,6 +711,11 @@ namespace Tokenizer {
     bool xmlout;
     bool xmlin;
     bool passthru;
+
+    // see setSpanMatching()
+    bool span_matching;
+    // see setLetterPath()
+    bool letter_path;
     bool ignore_tag_hints;
     mutable folia::processor *ucto_processor;
     mutable bool already_tokenized; // set when ucto is called again on tokenized FoLiA
@@ -415,10 +723,18 @@ namespace Tokenizer {
     std::string inputclass; // class for folia text
     std::string outputclass; // class for folia text
     std::string data_version; // the version of uctodata
-    TextCat *text_cat;
     folia::TextPolicy text_policy;
   };
 
+  class TokenizerSession: public TokenizerClass {
+    // a session on a shared TokenizerModel, which must outlive it. It can't
+    // be given another model
+  public:
+    explicit TokenizerSession( const TokenizerModel& m ) { init( &m ); };
+  private:
+    using TokenizerClass::init;
+  };
+
   template< typename T >
     T stringTo( const std::string& str ) {
     T result;
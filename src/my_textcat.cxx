@@ -38,12 +38,22 @@ using TiCC::operator<<;
 #define DBG *TiCC::Log(dbg)
 
 #ifdef HAVE_TEXTCAT
-TextCat::~TextCat() { textcat_Done( TC ); }
+TextCat::~TextCat() {
+  if ( TC ){
+    textcat_Done( TC );
+  }
+}
+
+TextCat::TextCat( const std::string& cf ): TC( 0 ), cfName( cf ) {}
+
+TextCat::TextCat( const TextCat& in ): TC( 0 ), cfName( in.cfName ) {}
 
-TextCat::TextCat( const std::string& cf, TiCC::LogStream *log ) {
-  debug = false;
-  dbg = log;
-  TC = textcat_Init( cf.c_str() );
+void TextCat::init() const {
+  // load the fingerprints. Only called with guess_mutex locked
+  if ( TC ){
+    return;
+  }
+  TC = textcat_Init( cfName.c_str() );
   //
   // we would like to do this, to get the same default everywhere
   // but the SetProperty API is not always available
@@ -53,54 +63,46 @@ TextCat::TextCat( const std::string& cf, TiCC::LogStream *log ) {
   // textcat_SetProperty( TC, TCPROP_MINIMUM_DOCUMENT_SIZE, 25 );
   //
   if ( TC == 0 ){
-    throw runtime_error( "TextCat init failed: " + cf );
+    throw runtime_error( "TextCat init failed: " + cfName );
   }
-  cfName = cf;
-
-}
-
-TextCat::TextCat( const TextCat& in ) {
-  debug = false;
-  dbg = in.dbg;
-  TC = textcat_Init( in.cfName.c_str() );
-  cfName = in.cfName;
 }
 
-bool TextCat::set_debug( bool b ){
-  if ( b && dbg == 0 ){
-    throw logic_error( "TexCat:cannot set debug to true, no debugstream available" );
-  }
-  bool result = debug;
-  debug = b;
-  return result;
-}
-
-vector<string> TextCat::get_languages( const string& in ) const {
-  if ( debug ){
+vector<string> TextCat::get_languages( const string& in,
+				       TiCC::LogStream *dbg ) const {
+  if ( dbg ){
     DBG << "textcat.get_languages( " << in << " )" << endl;
   }
   vector<string> vals;
-  char *res = textcat_Classify( TC, in.c_str(), in.size() );
-  if ( debug ){
-    if ( res ){
-      DBG << "textcat.get_languages, res= '" << res << "'" << endl;
+  string val;
+  {
+    lock_guard<mutex> lock( guess_mutex );
+    init();
+    char *res = textcat_Classify( TC, in.c_str(), in.size() );
+    if ( dbg ){
+      if ( res ){
+	DBG << "textcat.get_languages, res= '" << res << "'" << endl;
+      }
+      else {
+	DBG << "textcat.get_languages, res= NULL" << endl;
+      }
     }
-    else {
-      DBG << "textcat.get_languages, res= NULL" << endl;
+    if ( res ){
+      // copy it, before the next guess overwrites it
+      val = res;
     }
   }
-  if ( res && strlen(res) > 0 && strcmp( res, "SHORT" ) != 0 ){
-    string val = res;
+  if ( !val.empty() && val != "SHORT" ){
     vals = TiCC::split_at_first_of( val, "[]" );
   }
-  if ( debug ){
+  if ( dbg ){
     DBG << "textcat.get_languages found: " << vals << endl;
   }
   return vals;
 }
 
-string TextCat::get_language( const string& in ) const {
-  vector<string> vals = get_languages( in );
+string TextCat::get_language( const string& in,
+			      TiCC::LogStream *dbg ) const {
+  vector<string> vals = get_languages( in, dbg );
   if ( vals.size() > 0 ){
     return vals[0];
   }
@@ -120,11 +122,16 @@ TextCat::TextCat( const TextCat& in ): TC(0) {
   throw runtime_error( "TextCat::TextCat(): TextCat Support not available" );
 }
 
-vector<string> TextCat::get_languages( const string& in ) const {
+void TextCat::init() const {
+}
+
+vector<string> TextCat::get_languages( const string& in,
+				       TiCC::LogStream * ) const {
   throw runtime_error( "TextCat::get_languages(): TextCat Support not available" );
 }
 
-string TextCat::get_language( const string& in ) const {
+string TextCat::get_language( const string& in,
+			      TiCC::LogStream * ) const {
   throw runtime_error( "TextCat::get_language(): TextCat Support not available" );
 }
 
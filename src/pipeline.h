@@ -0,0 +1,258 @@
+/*
+  Copyright (c) 2006 - 2021
+  CLST - Radboud University
+  ILK  - Tilburg University
+
+  This file is part of Ucto
+
+  Ucto is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Ucto is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ucto/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef UCTO_PIPELINE_H
+#define UCTO_PIPELINE_H
+
+// the helpers of TokenizerClass for reading, writing and passing work
+// between threads. They are internal to the library, and not installed
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "unicode/unistr.h"
+#include "unicode/ucnv.h"
+
+namespace Tokenizer {
+
+  using namespace icu;
+
+  class LineReader {
+    // reads the lines of a stream or a memory mapped file in some encoding
+    // as UnicodeStrings.
+    // One ICU converter decodes the whole input in large chunks, keeping
+    // its state between them. A stream is read ahead, except for std::cin
+    // which is read line by line. A BOM at the start of the input
+    // overrules the given encoding.
+  public:
+  LineReader(): in(0), mapped(0), mapped_size(0), mapped_pos(0),
+      unmap(false), converter(0), pos(0), at_end(false), line_mode(false) {};
+    ~LineReader() { close(); };
+    LineReader( const LineReader& ) = delete;
+    LineReader& operator=( const LineReader& ) = delete;
+    void open( std::istream&, const std::string& );
+    bool map( const std::string&, const std::string& );
+    // read text in memory. It must stay there until we are closed
+    void open( const char *, size_t, const std::string& );
+    void close();
+    bool is_open( const std::istream& is ) const { return in == &is; };
+    bool getline( UnicodeString& );
+    const std::string& get_encoding() const { return encoding; };
+    bool interactive() const;
+  private:
+    void open_converter( const std::string& );
+    void fill( bool );
+    void detect_bom( const char *&, const char * );
+    std::istream *in;
+    const char *mapped;   // the mapped file, if any
+    size_t mapped_size;
+    size_t mapped_pos;    // the next byte to decode
+    bool unmap;           // mapped is our own mapping of a file
+    UConverter *converter;
+    std::string encoding;
+    std::vector<char> bytes;
+    UnicodeString buffer; // decoded text, from pos on not returned yet
+    int32_t pos;
+    bool at_end;          // all of the stream is in buffer
+    bool line_mode;       // don't read ahead more than one line
+    std::string raw;      // the last line read in line_mode
+  };
+
+  class Utf8Writer {
+    // writes text to a stream as UTF-8, through a large buffer.
+    // The stream itself is only flushed on request.
+  public:
+    explicit Utf8Writer( std::ostream& os ): out( os ) {
+      buffer.reserve( 2 * write_chunk );
+    };
+    ~Utf8Writer() { write_buffer(); };
+    Utf8Writer( const Utf8Writer& ) = delete;
+    Utf8Writer& operator=( const Utf8Writer& ) = delete;
+    void put( const UnicodeString& );
+    void put( const std::string& s ) { buffer += s; check(); };
+    void put( const char *s ) { buffer += s; check(); };
+    void put( char c ) { buffer += c; check(); };
+    void flush() { write_buffer(); out.flush(); };
+  private:
+    void check() { if ( buffer.size() >= write_chunk ) write_buffer(); };
+    void write_buffer() {
+      out.write( buffer.data(), buffer.size() );
+      buffer.clear();
+    };
+    static const size_t write_chunk = 65536;
+    std::ostream& out;
+    std::string buffer;
+  };
+
+  template <typename T>
+  class BoundedQueue {
+    // a FIFO queue between any number of threads, holding at most
+    // max_size items. Waiting threads sleep on a condition variable.
+    // push() waits while the queue is full, pop() while it is empty.
+    // After close(), push() fails and pop() fails once the queue is empty
+  public:
+    explicit BoundedQueue( size_t size ): max_size( size ), closed( false ) {};
+    BoundedQueue( const BoundedQueue& ) = delete;
+    BoundedQueue& operator=( const BoundedQueue& ) = delete;
+    bool push( T&& item ){
+      std::unique_lock<std::mutex> lock( mutex );
+      not_full.wait( lock,
+		     [this](){ return closed || items.size() < max_size; } );
+      if ( closed ){
+	return false;
+      }
+      items.push_back( std::move( item ) );
+      not_empty.notify_one();
+      return true;
+    };
+    bool pop( T& item ){
+      std::unique_lock<std::mutex> lock( mutex );
+      not_empty.wait( lock, [this](){ return closed || !items.empty(); } );
+      if ( items.empty() ){
+	return false;
+      }
+      item = std::move( items.front() );
+      items.pop_front();
+      not_full.notify_one();
+      return true;
+    };
+    void close(){
+      std::lock_guard<std::mutex> lock( mutex );
+      closed = true;
+      not_full.notify_all();
+      not_empty.notify_all();
+    };
+  private:
+    const size_t max_size;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+  };
+
+  class Backoff {
+    // waits for another thread without taking a lock: spin a little, then
+    // give up the processor, then sleep for longer and longer, up to a
+    // millisecond. So a stage that is ahead doesn't eat a whole CPU
+  public:
+    Backoff(): count( 0 ), delay( 10 ) {};
+    void wait(){
+      if ( count < 100 ){
+	++count;
+      }
+      else if ( count < 200 ){
+	++count;
+	std::this_thread::yield();
+      }
+      else {
+	std::this_thread::sleep_for( std::chrono::microseconds( delay ) );
+	delay = std::min( 2 * delay, 1000 );
+      }
+    };
+  private:
+    int count;
+    int delay;
+  };
+
+  template <typename T>
+  class RingBuffer {
+    // a lock free FIFO queue between exactly one producer thread and one
+    // consumer thread, holding at most size items.
+    // push() waits while the queue is full, pop() while it is empty.
+    // After close(), push() fails and pop() fails once the queue is empty.
+    // close() may be called from any thread
+  public:
+    explicit RingBuffer( size_t size ):
+      slots( size + 1 ), head( 0 ), tail( 0 ), closed( false ) {};
+    RingBuffer( const RingBuffer& ) = delete;
+    RingBuffer& operator=( const RingBuffer& ) = delete;
+    bool push( T&& item ){
+      // only the producer changes tail
+      const size_t t = tail.load( std::memory_order_relaxed );
+      const size_t next = ( t + 1 ) % slots.size();
+      Backoff backoff;
+      while ( true ){
+	if ( closed.load( std::memory_order_acquire ) ){
+	  return false;
+	}
+	if ( next != head.load( std::memory_order_acquire ) ){
+	  break;
+	}
+	backoff.wait();
+      }
+      slots[t] = std::move( item );
+      tail.store( next, std::memory_order_release );
+      return true;
+    };
+    bool pop( T& item ){
+      // only the consumer changes head
+      const size_t h = head.load( std::memory_order_relaxed );
+      Backoff backoff;
+      while ( h == tail.load( std::memory_order_acquire ) ){
+	if ( closed.load( std::memory_order_acquire )
+	     && h == tail.load( std::memory_order_acquire ) ){
+	  // the producer may have pushed just before closing
+	  return false;
+	}
+	backoff.wait();
+      }
+      item = std::move( slots[h] );
+      head.store( ( h + 1 ) % slots.size(), std::memory_order_release );
+      return true;
+    };
+    void close(){
+      closed.store( true, std::memory_order_release );
+    };
+  private:
+    std::vector<T> slots;    // one more than size: full leaves one free
+    std::atomic<size_t> head; // the next slot to pop
+    std::atomic<size_t> tail; // the next slot to push
+    std::atomic<bool> closed;
+  };
+
+  struct ParagraphChunk {
+    // a part of the input for tokenize_parallel(). Between stages
+    // tokenizing paragraphs, it runs from the line after an empty line up
+    // to the next empty line
+  ParagraphChunk(): number(0), first_line(0), first_length(0) {};
+    size_t number;       // the chunks are numbered in input order
+    std::vector<UnicodeString> lines;
+    int first_line;      // the line number before lines[0]
+    std::string output;  // the output, as if something came before it
+    std::string first;   // the first sentence, when nothing came before it
+    size_t first_length; // the length of that sentence in output
+  };
+
+}
+#endif // UCTO_PIPELINE_H
@@ -0,0 +1,549 @@
+/*
+  Copyright (c) 2006 - 2021
+  CLST - Radboud University
+  ILK  - Tilburg University
+
+  This file is part of Ucto
+
+  Ucto is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Ucto is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ucto/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#include "ucto/server.h"
+#include "pipeline.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "ticcutils/StringOps.h"
+
+#ifndef MSG_NOSIGNAL
+// not on every system. Server sockets get SO_NOSIGPIPE there
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace std;
+
+namespace Tokenizer {
+
+  // seconds a client of the server gets to send a whole request, or to
+  // take a whole response, before we drop the connection
+  const int io_timeout = 60;
+  // we read this much at a time
+  const size_t max_block = 65536;
+
+  RequestChannel::RequestChannel( int in, int out, size_t max, int secs ):
+    in_fd( in ),
+    out_fd( out ),
+    out_socket( false ),
+    max_request( max ),
+    timeout( secs ),
+    pos( 0 )
+  {
+    struct stat sb;
+    out_socket = fstat( out_fd, &sb ) == 0 && S_ISSOCK( sb.st_mode );
+  }
+
+  void RequestChannel::start_clock(){
+    if ( timeout > 0 ){
+      deadline = chrono::steady_clock::now() + chrono::seconds( timeout );
+    }
+  }
+
+  bool RequestChannel::wait( int fd, short events ){
+    // wait until fd is ready for events. false when the deadline passed,
+    // or we can't wait for it
+    while ( true ){
+      int left = -1;
+      if ( timeout > 0 ){
+	auto ms = chrono::duration_cast<chrono::milliseconds>
+	  ( deadline - chrono::steady_clock::now() ).count();
+	if ( ms <= 0 ){
+	  return false;
+	}
+	left = static_cast<int>( ms );
+      }
+      pollfd p = pollfd();
+      p.fd = fd;
+      p.events = events;
+      int n = poll( &p, 1, left );
+      if ( n > 0 ){
+	return true;
+      }
+      if ( n < 0 && errno != EINTR ){
+	return false;
+      }
+    }
+  }
+
+  bool RequestChannel::fill(){
+    // read more input into buffer. false at the end of the input
+    if ( pos > 0 ){
+      buffer.erase( 0, pos );
+      pos = 0;
+    }
+    char block[max_block];
+    while ( true ){
+      if ( !wait( in_fd, POLLIN ) ){
+	throw runtime_error( "request timed out" );
+      }
+      ssize_t n = ::read( in_fd, block, sizeof(block) );
+      if ( n > 0 ){
+	buffer.append( block, n );
+	return true;
+      }
+      if ( n < 0
+	   && ( errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK ) ){
+	continue;
+      }
+      return false;
+    }
+  }
+
+  bool RequestChannel::read( Request& request ){
+    if ( pos == buffer.size() && buffer.capacity() > 2 * max_block ){
+      // don't hang on to the memory of a large earlier request
+      buffer.clear();
+      buffer.shrink_to_fit();
+      pos = 0;
+    }
+    start_clock();
+    size_t eol;
+    while ( ( eol = buffer.find( '\n', pos ) ) == string::npos ){
+      size_t done = buffer.size() - pos;
+      if ( !fill() ){
+	if ( buffer.size() == pos ){
+	  // a clean end
+	  return false;
+	}
+	throw runtime_error( "incomplete request header" );
+      }
+      if ( done > 4096 ){
+	throw runtime_error( "request header too long" );
+      }
+    }
+    vector<string> parts = TiCC::split( buffer.substr( pos, eol - pos ) );
+    pos = eol + 1;
+    size_t length = 0;
+    bool terminated = parts.size() >= 2 && parts[1] == "-";
+    if ( parts.size() < 2
+	 || ( !terminated
+	      && ( parts[1].find_first_not_of( "0123456789" ) != string::npos
+		   || !TiCC::stringTo( parts[1], length ) ) ) ){
+      throw runtime_error( "malformed request header, expected: "
+			   "<id> <length> [option]..." );
+    }
+    if ( length > max_request ){
+      // refused before we read any of it
+      throw runtime_error( "request too large, the limit is "
+			   + TiCC::toString( max_request ) + " bytes" );
+    }
+    request.id = parts[0];
+    request.options.assign( parts.begin() + 2, parts.end() );
+    if ( terminated ){
+      // the text runs up to a NUL byte
+      size_t end;
+      size_t scanned = 0; // from pos on, no NUL in there
+      while ( ( end = buffer.find( '\0', pos + scanned ) ) == string::npos ){
+	scanned = buffer.size() - pos;
+	if ( scanned > max_request ){
+	  throw runtime_error( "request too large, the limit is "
+			       + TiCC::toString( max_request ) + " bytes" );
+	}
+	if ( !fill() ){
+	  throw runtime_error( "incomplete request text" );
+	}
+      }
+      request.text = buffer.substr( pos, end - pos );
+      pos = end + 1;
+      return true;
+    }
+    while ( buffer.size() - pos < length ){
+      if ( !fill() ){
+	throw runtime_error( "incomplete request text" );
+      }
+    }
+    request.text = buffer.substr( pos, length );
+    pos += length;
+    return true;
+  }
+
+  bool RequestChannel::write( const string& s ){
+    // write all of s. false when the other side is gone, or too slow
+    start_clock();
+    size_t done = 0;
+    while ( done < s.size() ){
+      ssize_t n;
+      if ( out_socket ){
+	n = send( out_fd, s.data() + done, s.size() - done, MSG_NOSIGNAL );
+      }
+      else {
+	n = ::write( out_fd, s.data() + done, s.size() - done );
+      }
+      if ( n < 0 ){
+	if ( errno == EINTR ){
+	  continue;
+	}
+	if ( ( errno == EAGAIN || errno == EWOULDBLOCK )
+	     && wait( out_fd, POLLOUT ) ){
+	  continue;
+	}
+	return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+
+  bool RequestChannel::write_output( const string& id, const string& output ){
+    return write( id + " OK " + TiCC::toString( output.size() ) + "\n"
+		  + output );
+  }
+
+  bool RequestChannel::write_error( const string& id, const string& message ){
+    string line = message;
+    replace( line.begin(), line.end(), '\n', ' ' );
+    return write( id + " ERROR " + line + "\n" );
+  }
+
+  struct SavedOptions {
+    // the options a request may change. They are restored when we go out
+    // of scope
+    explicit SavedOptions( TokenizerClass& s ):
+      session( s ),
+      per_line_output( s.getSentencePerLineOutput() ),
+      per_line_input( s.getSentencePerLineInput() ),
+      quotes( s.getQuoteDetection() ),
+      paragraphs( s.getParagraphDetection() ),
+      verbose( s.getVerbose() ),
+      language( s.getTextLanguage() ) {};
+    ~SavedOptions(){
+      session.setSentencePerLineOutput( per_line_output );
+      session.setSentencePerLineInput( per_line_input );
+      session.setQuoteDetection( quotes );
+      session.setParagraphDetection( paragraphs );
+      session.setVerbose( verbose );
+      session.setTextLanguage( language );
+    }
+    TokenizerClass& session;
+    const bool per_line_output;
+    const bool per_line_input;
+    const bool quotes;
+    const bool paragraphs;
+    const bool verbose;
+    const string language;
+  };
+
+  string TokenizerServer::handle( TokenizerClass& session,
+				  const Request& request ){
+    SavedOptions saved( session );
+    for ( const auto& option : request.options ){
+      if ( option == "-n" ){
+	session.setSentencePerLineOutput( true );
+      }
+      else if ( option == "-m" ){
+	session.setSentencePerLineInput( true );
+      }
+      else if ( option == "-Q" ){
+	session.setQuoteDetection( true );
+      }
+      else if ( option == "-P" ){
+	session.setParagraphDetection( false );
+      }
+      else if ( option == "-v" ){
+	session.setVerbose( true );
+      }
+      else if ( TiCC::match_front( option, "-L" ) && option.size() > 2 ){
+	string language = option.substr( 2 );
+	const TokenizerModel *model = session.getModel();
+	if ( !model
+	     || model->settings().find( language ) == model->settings().end() ){
+	  throw invalid_argument( "unsupported language: " + language );
+	}
+	session.setTextLanguage( language );
+      }
+      else {
+	throw invalid_argument( "unknown option: " + option );
+      }
+    }
+    session.reset();
+    istringstream in( request.text );
+    ostringstream out;
+    session.tokenize( in, out );
+    return out.str();
+  }
+
+  bool TokenizerServer::serve_one( RequestChannel& channel,
+				   TokenizerClass& session ){
+    Request request;
+    try {
+      if ( !channel.read( request ) ){
+	return false;
+      }
+    }
+    catch ( const exception& e ){
+      // we can't find the next request anymore. give up
+      channel.write_error( "-", e.what() );
+      return false;
+    }
+    try {
+      return channel.write_output( request.id, handle( session, request ) );
+    }
+    catch ( const exception& e ){
+      return channel.write_error( request.id, e.what() );
+    }
+  }
+
+  void TokenizerServer::serve( RequestChannel& channel,
+			       TokenizerClass& session ){
+    while ( serve_one( channel, session ) ){
+    }
+  }
+
+  TokenizerServer::TokenizerServer( const SessionFactory& f, size_t n,
+				    size_t max ):
+    factory( f ),
+    workers( n > 0 ? n : 1 ),
+    max_request( max ),
+    listen_fd( -1 )
+  {}
+
+  TokenizerServer::~TokenizerServer(){
+    if ( listen_fd >= 0 ){
+      close( listen_fd );
+    }
+    if ( !socket_path.empty() ){
+      unlink( socket_path.c_str() );
+    }
+  }
+
+  void TokenizerServer::listen_unix( const string& path ){
+    sockaddr_un address;
+    memset( &address, 0, sizeof(address) );
+    if ( path.size() >= sizeof(address.sun_path) ){
+      throw runtime_error( "socket path too long: " + path );
+    }
+    address.sun_family = AF_UNIX;
+    strcpy( address.sun_path, path.c_str() );
+    struct stat sb;
+    if ( lstat( path.c_str(), &sb ) == 0 ){
+      if ( !S_ISSOCK( sb.st_mode ) ){
+	throw runtime_error( "not a socket: " + path );
+      }
+      int probe = socket( AF_UNIX, SOCK_STREAM, 0 );
+      bool alive = probe >= 0
+	&& connect( probe, (sockaddr*)&address, sizeof(address) ) == 0;
+      if ( probe >= 0 ){
+	close( probe );
+      }
+      if ( alive ){
+	throw runtime_error( "another server is listening on " + path );
+      }
+      // left behind by an earlier server
+      unlink( path.c_str() );
+    }
+    listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( listen_fd < 0
+	 || bind( listen_fd, (sockaddr*)&address, sizeof(address) ) < 0
+	 || listen( listen_fd, 64 ) < 0 ){
+      throw runtime_error( "unable to listen on socket " + path + ": "
+			   + strerror( errno ) );
+    }
+    socket_path = path;
+  }
+
+  void TokenizerServer::listen_tcp( int port ){
+    sockaddr_in address;
+    memset( &address, 0, sizeof(address) );
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+    // only local clients
+    address.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+    listen_fd = socket( AF_INET, SOCK_STREAM, 0 );
+    int on = 1;
+    if ( listen_fd < 0
+	 || setsockopt( listen_fd, SOL_SOCKET, SO_REUSEADDR,
+			&on, sizeof(on) ) < 0
+	 || bind( listen_fd, (sockaddr*)&address, sizeof(address) ) < 0
+	 || listen( listen_fd, 64 ) < 0 ){
+      throw runtime_error( "unable to listen on port "
+			   + TiCC::toString( port ) + ": "
+			   + strerror( errno ) );
+    }
+  }
+
+  struct Connection {
+    // a client connection, with what was read from it already
+    Connection( int s, size_t max ):
+      fd( s ), channel( s, s, max, io_timeout ) {};
+    ~Connection(){ close( fd ); };
+    int fd;
+    RequestChannel channel;
+  private:
+    Connection( const Connection& ); // inhibit copies
+    Connection& operator=( const Connection& ); // inhibit copies
+  };
+
+  void TokenizerServer::run(){
+    if ( listen_fd < 0 ){
+      throw logic_error( "TokenizerServer::run() called before listening" );
+    }
+    vector<TokenizerClass*> sessions;
+    try {
+      for ( size_t i=0; i < workers; ++i ){
+	sessions.push_back( factory() );
+      }
+    }
+    catch ( ... ){
+      for ( const auto& session : sessions ){
+	delete session;
+      }
+      throw;
+    }
+    // the workers give a connection back after a request, and wake us up
+    int wake[2];
+    if ( pipe( wake ) < 0 ){
+      throw runtime_error( string("unable to create a pipe: ")
+			   + strerror( errno ) );
+    }
+    fcntl( wake[1], F_SETFL, O_NONBLOCK );
+    mutex returned_mutex;
+    vector<Connection*> returned;
+    // connections with a request, waiting for a worker
+    BoundedQueue<Connection*> requests( 4 * workers );
+    vector<thread> threads;
+    for ( const auto& session : sessions ){
+      threads.push_back( thread( [&,session](){
+	    Connection *connection;
+	    while ( requests.pop( connection ) ){
+	      if ( serve_one( connection->channel, *session ) ){
+		{
+		  lock_guard<mutex> lock( returned_mutex );
+		  returned.push_back( connection );
+		}
+		char c = 0;
+		if ( ::write( wake[1], &c, 1 ) < 0 ){
+		  // the pipe is full, so we are woken up anyway
+		}
+	      }
+	      else {
+		delete connection;
+	      }
+	    }
+	  } ) );
+    }
+    // the connections without a request for now
+    vector<Connection*> idle;
+    vector<pollfd> fds;
+    while ( true ){
+      {
+	lock_guard<mutex> lock( returned_mutex );
+	idle.insert( idle.end(), returned.begin(), returned.end() );
+	returned.clear();
+      }
+      fds.assign( 2, pollfd() );
+      fds[0].fd = listen_fd;
+      fds[0].events = POLLIN;
+      fds[1].fd = wake[0];
+      fds[1].events = POLLIN;
+      // a request that was read along with the previous one is waiting
+      // already, so don't block then
+      int timeout = -1;
+      for ( const auto& connection : idle ){
+	pollfd p = pollfd();
+	p.fd = connection->fd;
+	p.events = POLLIN;
+	fds.push_back( p );
+	if ( connection->channel.buffered() ){
+	  timeout = 0;
+	}
+      }
+      if ( poll( &fds[0], fds.size(), timeout ) < 0 ){
+	if ( errno == EINTR ){
+	  continue;
+	}
+	cerr << "ucto server: poll failed: " << strerror( errno ) << endl;
+	break;
+      }
+      if ( fds[1].revents ){
+	char buf[256];
+	if ( ::read( wake[0], buf, sizeof(buf) ) < 0 ){
+	  // nothing to do
+	}
+      }
+      vector<Connection*> still_idle;
+      for ( size_t i=0; i < idle.size(); ++i ){
+	if ( fds[i+2].revents || idle[i]->channel.buffered() ){
+	  // a request, or the end of the connection. A worker finds out
+	  requests.push( std::move( idle[i] ) );
+	}
+	else {
+	  still_idle.push_back( idle[i] );
+	}
+      }
+      idle.swap( still_idle );
+      if ( fds[0].revents ){
+	int fd = accept( listen_fd, 0, 0 );
+	if ( fd < 0 ){
+	  if ( errno == EINTR || errno == ECONNABORTED || errno == EAGAIN ){
+	    continue;
+	  }
+	  cerr << "ucto server: accept failed: " << strerror( errno ) << endl;
+	  break;
+	}
+	// a client that stops halfway a request or a response mustn't keep
+	// a worker past the deadline, so we never block on it
+	fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+#ifdef SO_NOSIGPIPE
+	// a client that goes away must not take us down
+	int on = 1;
+	setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on) );
+#endif
+	idle.push_back( new Connection( fd, max_request ) );
+      }
+    }
+    requests.close();
+    for ( auto& t : threads ){
+      t.join();
+    }
+    for ( const auto& connection : idle ){
+      delete connection;
+    }
+    for ( const auto& connection : returned ){
+      delete connection;
+    }
+    for ( const auto& session : sessions ){
+      delete session;
+    }
+    close( wake[0] );
+    close( wake[1] );
+  }
+}
@@ -34,6 +34,8 @@
 #include <vector>
 #include <algorithm>
 #include "config.h"
+#include "unicode/uchar.h"
+#include "unicode/usetiter.h"
 #include "ticcutils/StringOps.h"
 #include "ticcutils/FileUtils.h"
 #include "ticcutils/PrettyPrint.h"
@@ -134,20 +136,20 @@ namespace Tokenizer {
     return os;
   }
 
-  void Quoting::flushStack( int beginindex ) {
+  void QuoteStack::flushStack( size_t beginindex ) {
     //flush up to (but not including) the specified index
-    if ( !quotestack.empty() ){
-      std::vector<int> new_quoteindexstack;
-      std::vector<UChar32> new_quotestack;
-      for ( size_t i = 0; i < quotestack.size(); i++) {
-	if (quoteindexstack[i] >= beginindex ) {
-	  new_quotestack.push_back(quotestack[i]);
-	  new_quoteindexstack.push_back(quoteindexstack[i]-beginindex);
-	}
+    // the indices are absolute token positions, so the remaining ones
+    // stay valid.
+    size_t keep = 0;
+    for ( size_t i = 0; i < quotestack.size(); i++) {
+      if ( quoteindexstack[i] >= beginindex ) {
+	quotestack[keep] = quotestack[i];
+	quoteindexstack[keep] = quoteindexstack[i];
+	++keep;
       }
-      quoteindexstack = new_quoteindexstack;
-      quotestack = new_quotestack;
     }
+    quotestack.resize( keep );
+    quoteindexstack.resize( keep );
   }
 
   void Quoting::add( const UnicodeString& o, const UnicodeString& c ){
@@ -155,24 +157,63 @@ namespace Tokenizer {
     quote.openQuote = o;
     quote.closeQuote = c;
     _quotes.push_back( quote );
+    // index every character of the pair. When a character is part of
+    // several pairs, the first one wins, as it did in a linear search.
+    int id = _quotes.size()-1;
+    for ( int i=0; i < o.length(); i = o.moveIndex32( i, 1 ) ){
+      open_index.insert( make_pair( o.char32At( i ), id ) );
+    }
+    for ( int i=0; i < c.length(); i = c.moveIndex32( i, 1 ) ){
+      close_index.insert( make_pair( c.char32At( i ), id ) );
+    }
+  }
+
+  int Quoting::openPair( UChar32 c ) const {
+    // return the index of the QuotePair that has c as an opening quote
+    // or -1 when there is none
+    const auto it = open_index.find( c );
+    if ( it == open_index.end() ){
+      return -1;
+    }
+    return it->second;
   }
 
-  int Quoting::lookup( const UnicodeString& open, int& stackindex ){
-    if (quotestack.empty() || (quotestack.size() != quoteindexstack.size())) return -1;
+  int Quoting::closePair( UChar32 c ) const {
+    // return the index of the QuotePair that has c as a closing quote
+    // or -1 when there is none
+    const auto it = close_index.find( c );
+    if ( it == close_index.end() ){
+      return -1;
+    }
+    return it->second;
+  }
+
+  bool QuoteStack::lookup( const UnicodeString& open,
+			   int& stackindex,
+			   size_t& index ) const {
+    // find the last quote on the stack that is one of the characters in open
+    // returns its position on the stack and its token index
+    if (quotestack.empty() || (quotestack.size() != quoteindexstack.size())) return false;
     auto it = quotestack.crbegin();
     size_t i = quotestack.size();
     while ( it != quotestack.crend() ){
       if ( open.indexOf( *it ) >= 0 ){
  	stackindex = i-1;
- 	return quoteindexstack[stackindex];
+	index = quoteindexstack[stackindex];
+ 	return true;
       }
       --i;
       ++it;
     }
-    return -1;
+    return false;
   }
 
   UnicodeString Quoting::lookupOpen( const UnicodeString &q ) const {
+    if ( q.length() > 0 && q.moveIndex32( 0, 1 ) == q.length() ){
+      // 1 character
+      int pair = openPair( q.char32At( 0 ) );
+      return ( pair < 0 ) ? UnicodeString() : _quotes[pair].closeQuote;
+    }
     auto res = find_if( _quotes.begin(),
 			_quotes.end(),
 			[q]( const QuotePair& qp){ return qp.openQuote.indexOf(q) >=0; } );
@@ -184,8 +225,21 @@ namespace Tokenizer {
     }
   }
 
+  UnicodeString Quoting::characters() const {
+    UnicodeString result;
+    for ( const auto& quote : _quotes ){
+      result += quote.openQuote;
+      result += quote.closeQuote;
+    }
+    return result;
+  }
+
   UnicodeString Quoting::lookupClose( const UnicodeString &q ) const {
-    UnicodeString res;
+    if ( q.length() > 0 && q.moveIndex32( 0, 1 ) == q.length() ){
+      // 1 character
+      int pair = closePair( q.char32At( 0 ) );
+      return ( pair < 0 ) ? UnicodeString() : _quotes[pair].openQuote;
+    }
     for ( const auto& quote : _quotes ){
       if ( quote.closeQuote.indexOf(q) >= 0 )
 	return quote.openQuote;
@@ -193,49 +247,1506 @@ namespace Tokenizer {
     return "";
   }
 
+  uint16_t CharTable::classify( UChar32 c ) const {
+    uint16_t result = 0;
+    if ( u_isspace( c ) ){
+      result |= SPACE;
+    }
+    // u_ispunct(), u_isdigit(), u_isalpha(), u_isupper() and u_istitle()
+    // are all tests on the general category
+    int8_t type = u_charType( c );
+    uint32_t category = U_MASK( type );
+    if ( category & U_GC_P_MASK ){
+      result |= PUNCT;
+    }
+    if ( category & U_GC_ND_MASK ){
+      result |= DIGIT;
+    }
+    if ( category & U_GC_L_MASK ){
+      result |= ALPHA;
+    }
+    if ( category & ( U_GC_LU_MASK | U_GC_LT_MASK ) ){
+      result |= UPPER;
+    }
+    if ( u_hasBinaryProperty( c, UCHAR_QUOTATION_MARK )
+	 || c == '`'
+	 || c == U'´' ) {
+      // M$ users use the spacing grave and acute accents often as a
+      // quote (apostroph) but is DOESN`T have the UCHAR_QUOTATION_MARK property
+      // so trick that
+      result |= QUOTE;
+    }
+    else if ( quotes && c > 0xFFFF
+	      && ( quotes->openPair( c ) >= 0
+		   || quotes->closePair( c ) >= 0 ) ){
+      // for the BMP, build() takes care of this
+      result |= QUOTE;
+    }
+    UBlockCode block = ublock_getCode( c );
+    if ( block == UBLOCK_EMOTICONS ){
+      result |= EMOTICON;
+    }
+    if ( block == UBLOCK_MISCELLANEOUS_SYMBOLS_AND_PICTOGRAPHS ){
+      result |= PICTO;
+    }
+    if ( block == UBLOCK_BASIC_LATIN || block == UBLOCK_GREEK
+	 || block == UBLOCK_CYRILLIC || block == UBLOCK_GEORGIAN
+	 || block == UBLOCK_ARMENIAN || block == UBLOCK_DESERET ){
+      result |= CASED_BLOCK;
+    }
+    if ( type == U_CURRENCY_SYMBOL ){
+      result |= CURRENCY;
+    }
+    if ( type == U_CURRENCY_SYMBOL
+	 || type == U_MATH_SYMBOL
+	 || type == U_MODIFIER_SYMBOL
+	 || type == U_OTHER_SYMBOL ){
+      result |= SYMBOL;
+    }
+    return result;
+  }
+
+  void CharTable::build( const Quoting& q ){
+    quotes = &q;
+    table.clear();
+    table.reserve( 0x10000 );
+    for ( UChar32 c = 0; c < 0x10000; ++c ){
+      table.push_back( classify( c ) );
+    }
+    // a BMP character is a quote when it is part of one of the quotes.
+    // Walk the code points: a quote outside the BMP is a surrogate pair,
+    // which classify() handles
+    UnicodeString all = q.characters();
+    for ( int32_t i=0; i < all.length(); i = all.moveIndex32( i, 1 ) ){
+      UChar32 c = all.char32At( i );
+      if ( c < 0x10000 ){
+	table[c] |= QUOTE;
+      }
+    }
+  }
+
+  struct Needs {
+    // what a (sub)pattern needs to match: at least min characters, and
+    // at least one character from every set in sets.
+    Needs(): min(0) {};
+    int min;
+    vector<UnicodeSet> sets;
+  };
+
+  class PatternAnalyzer {
+    // a very limited regex parser, to derive Needs for a Rule pattern
+    // whenever we are not sure, we assume less. Which is always safe.
+    // analyze() fails on what we don't support at all: back references,
+    // lookbehind, set operations, case insensitivity and free spacing.
+    // Then the Rule gets no prefilter
+  public:
+    explicit PatternAnalyzer( const UnicodeString& p ):
+      pat(p), pos(0), caseless(false) {};
+    bool analyze( Needs& );
+  private:
+    bool parse_alternation( Needs& );
+    bool parse_sequence( Needs& );
+    bool parse_atom( Needs&, bool& );
+    bool parse_escape( Needs& );
+    bool parse_class( Needs& );
+    bool class_escape( UnicodeSet&, bool&, bool& );
+    bool parse_quantifier( int& );
+    bool at_end() const { return pos >= pat.length(); };
+    UChar32 current() const { return pat.char32At( pos ); };
+    void next() { pos = pat.moveIndex32( pos, 1 ); };
+    const UnicodeString& pat;
+    int pos;
+    bool caseless;
+  };
+
+  UnicodeSet make_set( const UnicodeString& spec ){
+    // build a set from an ICU set pattern. return a bogus set on failure
+    UErrorCode u_stat = U_ZERO_ERROR;
+    UnicodeSet result( spec, u_stat );
+    if ( U_FAILURE(u_stat) ){
+      result.setToBogus();
+    }
+    return result;
+  }
+
+  size_t selectivity( const UnicodeSet& s ){
+    return s.size();
+  }
+
+  bool PatternAnalyzer::analyze( Needs& result ){
+    if ( !parse_alternation( result ) || !at_end() ){
+      return false;
+    }
+    // case insensitive matching uses full case folding, so 1 character
+    // may match several, like 'ß' and "ss". We don't go there.
+    return !caseless;
+  }
+
+  bool PatternAnalyzer::parse_alternation( Needs& result ){
+    // alternatives: the minimum of the lengths, and the union of the
+    // most selective set of every alternative (when they all have one)
+    if ( !parse_sequence( result ) ){
+      return false;
+    }
+    if ( at_end() || current() != '|' ){
+      return true;
+    }
+    UnicodeSet total;
+    bool use_total = !result.sets.empty();
+    if ( use_total ){
+      total = result.sets[0];
+    }
+    while ( !at_end() && current() == '|' ){
+      next();
+      Needs alt;
+      if ( !parse_sequence( alt ) ){
+	return false;
+      }
+      result.min = std::min( result.min, alt.min );
+      if ( alt.sets.empty() ){
+	use_total = false;
+      }
+      else if ( use_total ){
+	total.addAll( alt.sets[0] );
+      }
+    }
+    result.sets.clear();
+    if ( use_total ){
+      result.sets.push_back( total );
+    }
+    return true;
+  }
+
+  bool PatternAnalyzer::parse_sequence( Needs& result ){
+    // a sequence: the sum of the lengths, and all the sets.
+    // sets[0] is kept the most selective one
+    while ( !at_end() && current() != '|' && current() != ')' ){
+      Needs atom;
+      bool zero_width = false;
+      if ( !parse_atom( atom, zero_width ) ){
+	return false;
+      }
+      int count = 1;
+      if ( !parse_quantifier( count ) ){
+	return false;
+      }
+      if ( count == 0 ){
+	continue;
+      }
+      if ( zero_width ){
+	continue;
+      }
+      result.min += count * atom.min;
+      for ( const auto& s : atom.sets ){
+	result.sets.push_back( s );
+	if ( selectivity( s ) < selectivity( result.sets[0] ) ){
+	  std::swap( result.sets[0], result.sets.back() );
+	}
+      }
+    }
+    return true;
+  }
+
+  bool PatternAnalyzer::parse_quantifier( int& count ){
+    // determine the minimal repeat count of the quantifier at pos, if any
+    count = 1;
+    if ( at_end() ){
+      return true;
+    }
+    UChar32 c = current();
+    if ( c == '*' || c == '?' ){
+      count = 0;
+      next();
+    }
+    else if ( c == '+' ){
+      next();
+    }
+    else if ( c == '{' ){
+      next();
+      int value = 0;
+      bool digits = false;
+      while ( !at_end() && u_isdigit( current() ) ){
+	value = 10*value + u_charDigitValue( current() );
+	digits = true;
+	next();
+      }
+      while ( !at_end() && current() != '}' ){
+	next();
+      }
+      if ( at_end() || !digits ){
+	return false;
+      }
+      next();
+      count = value;
+    }
+    else {
+      return true;
+    }
+    if ( !at_end() && ( current() == '?' || current() == '+' ) ){
+      // lazy or possessive
+      next();
+    }
+    return true;
+  }
+
+  bool PatternAnalyzer::parse_atom( Needs& result, bool& zero_width ){
+    UChar32 c = current();
+    if ( c == '(' ){
+      next();
+      bool lookaround = false;
+      if ( !at_end() && current() == '?' ){
+	next();
+	if ( at_end() ){
+	  return false;
+	}
+	c = current();
+	if ( c == ':' || c == '>' ){
+	  next();
+	}
+	else if ( c == '=' || c == '!' ){
+	  lookaround = true;
+	  next();
+	}
+	else if ( c == '<' ){
+	  next();
+	  if ( !at_end() && ( current() == '=' || current() == '!' ) ){
+	    // lookbehind: not supported
+	    return false;
+	  }
+	  else {
+	    // named group
+	    while ( !at_end() && current() != '>' ){
+	      next();
+	    }
+	    if ( at_end() ){
+	      return false;
+	    }
+	    next();
+	  }
+	}
+	else {
+	  // flags, like (?i) or (?i-m:
+	  while ( !at_end() && current() != ')' && current() != ':' ){
+	    if ( current() == 'i' ){
+	      caseless = true;
+	    }
+	    else if ( current() == 'x' ){
+	      // free spacing. not supported
+	      return false;
+	    }
+	    next();
+	  }
+	  if ( at_end() ){
+	    return false;
+	  }
+	  if ( current() == ')' ){
+	    next();
+	    zero_width = true;
+	    return true;
+	  }
+	  next();
+	}
+      }
+      Needs inner;
+      if ( !parse_alternation( inner ) ){
+	return false;
+      }
+      if ( at_end() || current() != ')' ){
+	return false;
+      }
+      next();
+      if ( lookaround ){
+	zero_width = true;
+      }
+      else {
+	result = inner;
+      }
+      return true;
+    }
+    else if ( c == '[' ){
+      return parse_class( result );
+    }
+    else if ( c == '\\' ){
+      next();
+      if ( at_end() ){
+	return false;
+      }
+      c = current();
+      if ( c == 'b' || c == 'B' || c == 'A' || c == 'Z' || c == 'z'
+	   || c == 'G' ){
+	next();
+	zero_width = true;
+	return true;
+      }
+      if ( c == 'k' || ( c >= '1' && c <= '9' ) || c == 'Q' ){
+	// back references and quoted literal text: not supported
+	return false;
+      }
+      return parse_escape( result );
+    }
+    else if ( c == '^' || c == '$' ){
+      next();
+      zero_width = true;
+      return true;
+    }
+    else if ( c == '.' ){
+      next();
+      result.min = 1;
+      return true;
+    }
+    else if ( c == '*' || c == '+' || c == '?' || c == '{' ){
+      return false;
+    }
+    result.min = 1;
+    result.sets.push_back( UnicodeSet( c, c ) );
+    next();
+    return true;
+  }
+
+  bool PatternAnalyzer::parse_escape( Needs& result ){
+    // pos is just after the '\'
+    result.min = 1;
+    UnicodeSet set;
+    bool known = false;
+    bool exact = false;
+    if ( !class_escape( set, known, exact ) ){
+      return false;
+    }
+    if ( known ){
+      result.sets.push_back( set );
+    }
+    return true;
+  }
+
+  bool PatternAnalyzer::class_escape( UnicodeSet& set,
+				     bool& known,
+				     bool& exact ){
+    // interpret the escape sequence after a '\' as a set of characters
+    // when we don't know the set, known is false. When the set may be
+    // larger than the real one, exact is false.
+    known = false;
+    exact = true;
+    UChar32 c = current();
+    next();
+    if ( c == 'p' || c == 'P' ){
+      UnicodeString prop;
+      if ( !at_end() && current() == '{' ){
+	int end = pat.indexOf( '}', pos );
+	if ( end < 0 ){
+	  return false;
+	}
+	prop = UnicodeString( pat, pos, end - pos + 1 );
+	pos = end + 1;
+      }
+      else if ( !at_end() ){
+	prop = "{" + UnicodeString( current() ) + "}";
+	next();
+      }
+      else {
+	return false;
+      }
+      set = make_set( "[\\" + UnicodeString(c) + prop + "]" );
+      known = !set.isBogus();
+    }
+    else if ( c == 'd' ){
+      set = make_set( "[\\p{Nd}]" );
+      known = true;
+    }
+    else if ( c == 'D' ){
+      set = make_set( "[\\P{Nd}]" );
+      known = true;
+    }
+    else if ( c == 's' ){
+      // a superset of \s
+      set = make_set( "[\\u0009-\\u000D\\u0085\\p{Z}]" );
+      known = true;
+      exact = false;
+    }
+    else if ( c == 'w' ){
+      // a superset of \w
+      set = make_set( "[\\p{Alphabetic}\\p{M}\\p{Nd}\\p{Pc}\\u200C\\u200D]" );
+      known = true;
+      exact = false;
+    }
+    else if ( c == 'x' || c == 'u' || c == 'U' ){
+      UnicodeString hex;
+      if ( c == 'x' && !at_end() && current() == '{' ){
+	int end = pat.indexOf( '}', pos );
+	if ( end < 0 ){
+	  return false;
+	}
+	hex = UnicodeString( pat, pos+1, end - pos - 1 );
+	pos = end + 1;
+      }
+      else {
+	int len = ( c == 'x' ? 2 : ( c == 'u' ? 4 : 8 ) );
+	hex = UnicodeString( pat, pos, len );
+	pos += hex.length();
+      }
+      UChar32 value = 0;
+      for ( int i=0; i < hex.length(); ++i ){
+	int digit = u_digit( hex[i], 16 );
+	if ( digit < 0 ){
+	  return false;
+	}
+	value = 16*value + digit;
+      }
+      if ( value > 0x10FFFF ){
+	return false;
+      }
+      set = UnicodeSet( value, value );
+      known = true;
+    }
+    else if ( c == 't' || c == 'n' || c == 'r' || c == 'f' || c == 'e'
+	      || c == 'a' ){
+      UChar32 value = ( c == 't' ? 0x09 : c == 'n' ? 0x0A : c == 'r' ? 0x0D
+			: c == 'f' ? 0x0C : c == 'e' ? 0x1B : 0x07 );
+      set = UnicodeSet( value, value );
+      known = true;
+    }
+    else if ( c == 'N' ){
+      // named character
+      int end = pat.indexOf( '}', pos );
+      if ( end < 0 ){
+	return false;
+      }
+      pos = end + 1;
+    }
+    else if ( c == 'c' ){
+      // control character
+      if ( at_end() ){
+	return false;
+      }
+      next();
+    }
+    else if ( c == '0' ){
+      // octal
+      while ( !at_end() && current() >= '0' && current() <= '7' ){
+	next();
+      }
+    }
+    else if ( u_isalnum( c ) ){
+      // \X, \R, \h, \v etc.
+    }
+    else {
+      // an escaped literal like \. or \-
+      set = UnicodeSet( c, c );
+      known = true;
+    }
+    return true;
+  }
+
+  bool PatternAnalyzer::parse_class( Needs& result ){
+    // a [...] set. Only simple sets are interpreted. For nested sets we
+    // just skip to the closing ']', set operations aren't supported
+    next();
+    result.min = 1;
+    bool negate = false;
+    if ( !at_end() && current() == '^' ){
+      negate = true;
+      next();
+    }
+    UnicodeSet set;
+    bool known = true;
+    bool exact = true;
+    bool first = true;
+    UChar32 previous = U_SENTINEL; // last single character, for ranges
+    while ( !at_end() ){
+      UChar32 c = current();
+      if ( c == ']' && !first ){
+	break;
+      }
+      first = false;
+      if ( c == '[' ){
+	// nested set: give up, but find the end
+	known = false;
+	int depth = 0;
+	while ( !at_end() ){
+	  if ( current() == '\\' ){
+	    next();
+	  }
+	  else if ( current() == '[' ){
+	    ++depth;
+	  }
+	  else if ( current() == ']' && --depth == 0 ){
+	    next();
+	    break;
+	  }
+	  if ( !at_end() ){
+	    next();
+	  }
+	}
+	previous = U_SENTINEL;
+	continue;
+      }
+      if ( c == '\\' ){
+	next();
+	if ( at_end() ){
+	  return false;
+	}
+	UnicodeSet sub;
+	bool sub_known = false;
+	bool sub_exact = false;
+	if ( !class_escape( sub, sub_known, sub_exact ) ){
+	  return false;
+	}
+	if ( !sub_known ){
+	  known = false;
+	  previous = U_SENTINEL;
+	}
+	else {
+	  exact &= sub_exact;
+	  set.addAll( sub );
+	  previous = ( sub.size() == 1 ? sub.charAt(0) : U_SENTINEL );
+	}
+	continue;
+      }
+      if ( ( c == '&' || c == '-' )
+	   && pos+1 < pat.length() && pat[pos+1] == c ){
+	// set operations: not supported
+	return false;
+      }
+      if ( c == '-' && previous != U_SENTINEL
+	   && pos+1 < pat.length() && pat[pos+1] != ']' ){
+	next();
+	UChar32 upper = current();
+	if ( upper == '\\' ){
+	  next();
+	  if ( at_end() ){
+	    return false;
+	  }
+	  UnicodeSet sub;
+	  bool sub_known = false;
+	  bool sub_exact = false;
+	  if ( !class_escape( sub, sub_known, sub_exact ) ){
+	    return false;
+	  }
+	  if ( !sub_known || sub.size() != 1 ){
+	    known = false;
+	    previous = U_SENTINEL;
+	    continue;
+	  }
+	  upper = sub.charAt(0);
+	}
+	else {
+	  next();
+	}
+	if ( upper < previous ){
+	  return false;
+	}
+	set.add( previous, upper );
+	previous = U_SENTINEL;
+	continue;
+      }
+      set.add( c );
+      previous = c;
+      next();
+    }
+    if ( at_end() ){
+      return false;
+    }
+    next(); // the ']'
+    if ( known && negate ){
+      // the complement of a superset is too small
+      known = exact;
+      set.complement();
+    }
+    if ( known ){
+      result.sets.push_back( set );
+    }
+    return true;
+  }
+
+  void Rule::build_prefilter(){
+    // derive a cheap necessary condition from the pattern.
+    min_length = 0;
+    required.clear();
+    Needs needs;
+    PatternAnalyzer analyzer( pattern );
+    if ( !analyzer.analyze( needs ) ){
+      // not understood. Always run the regex
+      return;
+    }
+    min_length = needs.min;
+    // keep the 2 most selective sets, which are not too large to be useful
+    sort( needs.sets.begin(), needs.sets.end(),
+	  []( const UnicodeSet& a, const UnicodeSet& b ){
+	    return selectivity( a ) < selectivity( b ); } );
+    for ( auto& s : needs.sets ){
+      if ( required.size() == 2 ){
+	break;
+      }
+      s.freeze();
+      required.push_back( s );
+    }
+  }
+
+  bool Rule::mayMatch( const UnicodeString& line ) const {
+    // a false result guarantees that the pattern doesn't match line
+    // line.length() counts UTF-16 units, which is never less than the
+    // number of characters
+    if ( line.length() < min_length ){
+      return false;
+    }
+    for ( const auto& s : required ){
+      if ( s.span( line, 0, USET_SPAN_NOT_CONTAINED ) == line.length() ){
+	return false;
+      }
+    }
+    return true;
+  }
+
+  bool literal_entry( const UnicodeString& entry, UnicodeString& literal ){
+    // check if an abbreviation entry, in regex form, is just a literal
+    // string, and return that string.
+    literal.remove();
+    for ( int i=0; i < entry.length(); ++i ){
+      UChar c = entry[i];
+      if ( c == '\\' ){
+	if ( i+1 == entry.length() || u_isalnum( entry[i+1] ) ){
+	  return false;
+	}
+	literal += entry[++i];
+      }
+      else if ( UnicodeString( ".^$[](){}*+?|" ).indexOf( c ) >= 0 ){
+	return false;
+      }
+      else {
+	literal += c;
+      }
+    }
+    return !literal.isEmpty();
+  }
+
+  static UnicodeSet make_full_fold_set(){
+    // the characters with a case folding of more than 1 character, like
+    // ß -> ss. ICU matches these with the full folding, the trie can't.
+    UErrorCode u_stat = U_ZERO_ERROR;
+    UnicodeSet candidates( "[:Changes_When_Casefolded:]", u_stat );
+    UnicodeSet result;
+    UnicodeSetIterator it( candidates );
+    while ( it.next() ){
+      UChar32 c = it.getCodepoint();
+      UnicodeString full( c );
+      full.foldCase();
+      if ( full != UnicodeString( u_foldCase( c, U_FOLD_CASE_DEFAULT ) ) ){
+	result.add( c );
+      }
+    }
+    return result;
+  }
+
+  static const UnicodeSet& full_fold_set(){
+    static const UnicodeSet result = make_full_fold_set();
+    return result;
+  }
+
+  void AbbreviationTrie::insert( vector<Node>& nodes,
+				 const UnicodeString& literal,
+				 int index ){
+    int node = 0;
+    for ( int i=0; i < literal.length(); ++i ){
+      auto it = nodes[node].next.find( literal[i] );
+      if ( it == nodes[node].next.end() ){
+	nodes.push_back( Node() );
+	int new_node = nodes.size()-1;
+	nodes[node].next[literal[i]] = new_node;
+	node = new_node;
+      }
+      else {
+	node = it->second;
+      }
+    }
+    nodes[node].ends.push_back( index );
+  }
+
+  void AbbreviationTrie::add( const UnicodeString& entry ){
+    int index = entries.size();
+    entries.push_back( entry );
+    UnicodeString literal;
+    if ( !literal_entry( entry, literal ) ){
+      always.push_back( index );
+      return;
+    }
+    insert( exact, literal, index );
+    // the simple case folding, 1 character at a time
+    UnicodeString fold;
+    for ( int i=0; i < literal.length(); i = literal.moveIndex32( i, 1 ) ){
+      UChar32 c = literal.char32At( i );
+      if ( full_fold_set().contains( c ) ){
+	full_folds = true;
+      }
+      fold += u_foldCase( c, U_FOLD_CASE_DEFAULT );
+    }
+    insert( folded, fold, index );
+  }
+
+  UnicodeString AbbreviationTrie::alternation() const {
+    // all entries, as the META-RULES insert them: a|b|c
+    UnicodeString result;
+    for ( const auto& e : entries ){
+      if ( !result.isEmpty() ){
+	result += "|";
+      }
+      result += e;
+    }
+    return result;
+  }
+
+  void AbbreviationTrie::matches( const UnicodeString& line,
+				  int start,
+				  bool caseless,
+				  vector<pair<int,int>>& result ) const {
+    // find the literal entries that match line at start, as pairs of
+    // ( entry, end of the match ), in the order of the entries
+    result.clear();
+    const vector<Node>& nodes = ( caseless ? folded : exact );
+    int node = 0;
+    int i = start;
+    while ( i < line.length() ){
+      UChar32 c = line.char32At( i );
+      i += U16_LENGTH( c );
+      if ( caseless ){
+	c = u_foldCase( c, U_FOLD_CASE_DEFAULT );
+      }
+      UChar units[2];
+      int len = 0;
+      U16_APPEND_UNSAFE( units, len, c );
+      for ( int j=0; j < len && node >= 0; ++j ){
+	auto it = nodes[node].next.find( units[j] );
+	node = ( it == nodes[node].next.end() ? -1 : it->second );
+      }
+      if ( node < 0 ){
+	break;
+      }
+      for ( const auto& e : nodes[node].ends ){
+	result.push_back( make_pair( e, i ) );
+      }
+    }
+    sort( result.begin(), result.end() );
+  }
+
+  void get_spans( RegexMatcher *matcher,
+		  vector<pair<int,int>>& spans ){
+    // the spans of all groups of the last succesful match of matcher
+    spans.clear();
+    UErrorCode u_stat = U_ZERO_ERROR;
+    for ( int i=0; i <= matcher->groupCount(); ++i ){
+      spans.push_back( make_pair( matcher->start( i, u_stat ),
+				  matcher->end( i, u_stat ) ) );
+    }
+  }
+
+  void split_match( const UnicodeString& line,
+		    const vector<pair<int,int>>& spans,
+		    RuleMatch& result ){
+    // find the spans of pre, post and the matched groups, from the spans
+    // of all groups of a match. Unmatched groups have start -1.
+    // this mimics TiCC::UnicodeRegexMatcher::match_all(), which ucto used
+    // before, so we give exactly the same results
+    result.clear();
+    int end = 0;
+    for ( const auto& span : spans ){
+      int start = span.first;
+      if ( start < 0 ){
+	continue;
+      }
+      if ( start > end ){
+	// note: match_all() takes 'start' characters here, not start-end
+	result.pre = MatchSpan( end, min( start, line.length() - end ) );
+      }
+      end = span.second;
+      result.groups.push_back( MatchSpan( start, end - start ) );
+    }
+    if ( end < line.length() ){
+      result.post = MatchSpan( end, line.length() - end );
+    }
+    if ( result.groups.size() > 1 ){
+      // only the groups, not the whole match
+      result.groups.erase( result.groups.begin() );
+    }
+  }
+
+  void copy_match( const UnicodeString& line,
+		   const RuleMatch& match,
+		   UnicodeString& pre,
+		   UnicodeString& post,
+		   vector<UnicodeString>& matches ){
+    // fill pre, post and matches with copies of the parts of match
+    pre = UnicodeString( line, match.pre.start, match.pre.length );
+    post = UnicodeString( line, match.post.start, match.post.length );
+    for ( const auto& g : match.groups ){
+      matches.push_back( UnicodeString( line, g.start, g.length ) );
+    }
+  }
+
+  bool Rule::excludes( const UnicodeSet& chars ) const {
+    // return true when the pattern can never match a string made of
+    // characters from chars only
+    for ( const auto& s : required ){
+      if ( s.containsNone( chars ) ){
+	return true;
+      }
+    }
+    return false;
+  }
+
   Rule::~Rule() {
-    delete regexp;
+    delete regex;
+    delete prefix_regex;
+    delete suffix_regex;
+  }
+
+  RegexPattern *compile_pattern( const UnicodeString& pattern ){
+    // returns 0 for an invalid pattern
+    UErrorCode u_stat = U_ZERO_ERROR;
+    UParseError errorInfo;
+    RegexPattern *result = RegexPattern::compile( pattern, 0,
+						  errorInfo, u_stat );
+    if ( U_FAILURE(u_stat) ){
+      delete result;
+      return 0;
+    }
+    return result;
   }
 
   Rule::Rule( const UnicodeString& _id, const UnicodeString& _pattern):
-    id(_id), pattern(_pattern) {
-    regexp = new TiCC::UnicodeRegexMatcher( pattern, id );
+    id(_id), pattern(_pattern), lookup(0), prefix_regex(0), suffix_regex(0),
+    caseless(false), prefix_groups(0) {
+    regex = compile_pattern( pattern );
+    if ( regex == 0 ){
+      throw invalid_argument( "Invalid regular expression '"
+			      + TiCC::UnicodeToUTF8(id) + "': "
+			      + TiCC::UnicodeToUTF8(pattern) );
+    }
+    build_prefilter();
+  }
+
+  struct OpenGroup {
+    // a group that the prefix of a lookup rule opens, and doesn't close
+    OpenGroup( const UnicodeString& o, int n ):
+      open(o), number(n), alternates(false), empty(true) {};
+    UnicodeString open;  // the text that opens it, like ( or (?:
+    UnicodeString flags; // the inline flags in it, like (?i)
+    int number;          // the group number, 0 when it doesn't capture
+    bool alternates;     // it has a |
+    bool empty;          // it has nothing but inline flags
+  };
+
+  enum GroupKind { CAPTURING, PLAIN, FLAGS, COMMENT, OTHER, UNKNOWN };
+
+  static GroupKind group_open( const UnicodeString& pat, int& i ){
+    // pat[i] is a '('. move i past the text that opens the group
+    if ( i+1 >= pat.length() || pat[i+1] != '?' ){
+      ++i;
+      return CAPTURING;
+    }
+    int j = i+2;
+    if ( j >= pat.length() ){
+      return UNKNOWN;
+    }
+    switch ( pat[j] ){
+    case ':':
+      i = j+1;
+      return PLAIN;
+    case '#':
+      j = pat.indexOf( ')', j );
+      if ( j < 0 ){
+	return UNKNOWN;
+      }
+      i = j+1;
+      return COMMENT;
+    case '=':
+    case '!':
+    case '>':
+      i = j+1;
+      return OTHER;
+    case '<':
+      if ( j+1 < pat.length() && ( pat[j+1] == '=' || pat[j+1] == '!' ) ){
+	i = j+2;
+	return OTHER;
+      }
+      j = pat.indexOf( '>', j );
+      if ( j < 0 ){
+	return UNKNOWN;
+      }
+      i = j+1;
+      return CAPTURING;
+    default:
+      // flags. x is left out, it changes the meaning of the abbreviations
+      while ( j < pat.length() && UnicodeString( "imsw-" ).indexOf( pat[j] ) >= 0 ){
+	++j;
+      }
+      if ( j < pat.length() && ( pat[j] == ')' || pat[j] == ':' ) ){
+	i = j+1;
+	return ( pat[j] == ')' ? FLAGS : PLAIN );
+      }
+    }
+    return UNKNOWN;
+  }
+
+  static int skip_escape( const UnicodeString& pat, int i, bool in_prefix ){
+    // pat[i] is a '\'. return the position after the escape, or -1 for a
+    // back reference and the like, that don't work on a part of a pattern
+    if ( i+1 >= pat.length() ){
+      return -1;
+    }
+    UChar c = pat[i+1];
+    if ( ( c >= '1' && c <= '9' ) || c == 'k' || c == 'G'
+	 || ( in_prefix && ( c == 'z' || c == 'Z' ) ) ){
+      return -1;
+    }
+    if ( c == 'Q' ){
+      int end = pat.indexOf( "\\E", i+2 );
+      return ( end < 0 ? pat.length() : end+2 );
+    }
+    return i+2;
+  }
+
+  static int skip_class( const UnicodeString& pat, int i ){
+    // pat[i] is a '['. return the position after the set, or -1
+    int depth = 0;
+    while ( i < pat.length() ){
+      if ( pat[i] == '\\' ){
+	i += 2;
+	continue;
+      }
+      if ( pat[i] == '[' ){
+	++depth;
+      }
+      else if ( pat[i] == ']' && --depth == 0 ){
+	return i+1;
+      }
+      ++i;
+    }
+    return -1;
+  }
+
+  static bool scan_prefix( const UnicodeString& pat,
+			   vector<OpenGroup>& open,
+			   int& groups ){
+    // find the groups that pat opens and leaves open, and count the
+    // capturing groups. The last one must enclose the abbreviations only,
+    // and none of them may have alternatives
+    open.assign( 1, OpenGroup( "", 0 ) ); // the pattern itself
+    groups = 0;
+    int i = 0;
+    while ( i < pat.length() ){
+      switch ( pat[i] ){
+      case '\\':
+	i = skip_escape( pat, i, true );
+	open.back().empty = false;
+	break;
+      case '[':
+	i = skip_class( pat, i );
+	open.back().empty = false;
+	break;
+      case '(': {
+	int start = i;
+	GroupKind kind = group_open( pat, i );
+	UnicodeString text( pat, start, i-start );
+	if ( kind == UNKNOWN ){
+	  return false;
+	}
+	else if ( kind == FLAGS ){
+	  open.back().flags += text;
+	}
+	else if ( kind != COMMENT ){
+	  open.back().empty = false;
+	  open.push_back( OpenGroup( text, kind == CAPTURING ? ++groups : 0 ) );
+	  if ( kind == OTHER ){
+	    // may not stay open
+	    open.back().alternates = true;
+	  }
+	}
+	break;
+      }
+      case ')':
+	if ( open.size() == 1 ){
+	  return false;
+	}
+	open.pop_back();
+	++i;
+	break;
+      case '|':
+	open.back().alternates = true;
+	++i;
+	break;
+      case '$':
+	return false;
+      default:
+	open.back().empty = false;
+	++i;
+      }
+      if ( i < 0 ){
+	return false;
+      }
+    }
+    if ( open.size() < 2 || !open.back().empty ){
+      return false;
+    }
+    for ( const auto& g : open ){
+      if ( g.alternates ){
+	return false;
+      }
+    }
+    return true;
+  }
+
+  static bool scan_suffix( const UnicodeString& pat, size_t open ){
+    // check that pat first closes the group around the abbreviations, and
+    // then the other open groups, without repeating them or adding
+    // alternatives to them
+    if ( pat.isEmpty() || pat[0] != ')' ){
+      return false;
+    }
+    int local = 0; // the groups opened in pat itself
+    int i = 0;
+    while ( i < pat.length() ){
+      switch ( pat[i] ){
+      case '\\':
+	i = skip_escape( pat, i, false );
+	break;
+      case '[':
+	i = skip_class( pat, i );
+	break;
+      case '(': {
+	GroupKind kind = group_open( pat, i );
+	if ( kind == UNKNOWN ){
+	  return false;
+	}
+	if ( kind != FLAGS && kind != COMMENT ){
+	  ++local;
+	}
+	break;
+      }
+      case ')':
+	++i;
+	if ( local > 0 ){
+	  --local;
+	}
+	else {
+	  if ( open == 0 ){
+	    return false;
+	  }
+	  --open;
+	  if ( i < pat.length()
+	       && UnicodeString( "?*+{" ).indexOf( pat[i] ) >= 0 ){
+	    return false;
+	  }
+	}
+	break;
+      case '|':
+	if ( local == 0 ){
+	  return false;
+	}
+	++i;
+	break;
+      default:
+	++i;
+      }
+      if ( i < 0 ){
+	return false;
+      }
+    }
+    return open == 0 && local == 0;
+  }
+
+  static int group_count( const RegexPattern *pattern ){
+    UErrorCode u_stat = U_ZERO_ERROR;
+    RegexMatcher *m = pattern->matcher( u_stat );
+    int result = ( U_SUCCESS(u_stat) ? m->groupCount() : -1 );
+    delete m;
+    return result;
+  }
+
+  static void set_flags( const UnicodeString& text, bool& caseless ){
+    // apply the flags in text, like (?i) or (?-i:, to caseless
+    if ( !text.startsWith( "(?" ) || text.startsWith( "(?<" ) ){
+      return;
+    }
+    bool on = true;
+    for ( int i=0; i < text.length(); ++i ){
+      if ( text[i] == '-' ){
+	on = false;
+      }
+      else if ( text[i] == 'i' ){
+	caseless = on;
+      }
+      else if ( text[i] == ')' || text[i] == ':' ){
+	on = true;
+      }
+    }
+  }
+
+  Rule::Rule( const UnicodeString& _id,
+	      const UnicodeString& _prefix,
+	      const AbbreviationTrie& trie,
+	      const UnicodeString& _suffix ):
+    id(_id), pattern(_prefix + trie.alternation() + _suffix),
+    lookup(&trie), prefix_regex(0), suffix_regex(0),
+    caseless(false), prefix_groups(0) {
+    // the same pattern as any META-RULE, but when possible we look the
+    // abbreviations up in the trie
+    regex = compile_pattern( pattern );
+    if ( regex == 0 ){
+      throw invalid_argument( "Invalid regular expression '"
+			      + TiCC::UnicodeToUTF8(id) + "': "
+			      + TiCC::UnicodeToUTF8(pattern) );
+    }
+    if ( !split_lookup( _prefix, _suffix ) ){
+      lookup = 0;
+    }
+    build_prefilter();
+  }
+
+  bool Rule::split_lookup( const UnicodeString& prefix,
+			   const UnicodeString& suffix ){
+    // a lookup only gives the same results as the pattern when the
+    // abbreviations are plain literals, in a group of their own, which is
+    // not repeated, and not part of an alternation. Then the pattern is
+    // just prefix, one of the abbreviations, and suffix, in that order.
+    // We match the prefix with '(?:prefix)\z' on the part before the
+    // abbreviation. The suffix is matched with the groups it closes
+    // opened again in front of it.
+    vector<OpenGroup> open;
+    if ( !lookup->literal()
+	 || !scan_prefix( prefix, open, prefix_groups )
+	 || !scan_suffix( suffix, open.size()-1 ) ){
+      return false;
+    }
+    UnicodeString prefix_pat = "(?:" + prefix;
+    UnicodeString suffix_pat;
+    for ( const auto& g : open ){
+      set_flags( g.open, caseless );
+      set_flags( g.flags, caseless );
+      if ( g.number > 0 ){
+	open_groups.push_back( g.number );
+      }
+      if ( !g.open.isEmpty() ){
+	prefix_pat += ")";
+      }
+      suffix_pat += g.open + g.flags;
+    }
+    prefix_pat += ")\\z";
+    suffix_pat += suffix;
+    if ( caseless && lookup->hasFullFolds() ){
+      return false;
+    }
+    prefix_regex = compile_pattern( prefix_pat );
+    suffix_regex = compile_pattern( suffix_pat );
+    if ( prefix_regex == 0 || suffix_regex == 0
+	 || prefix_groups + group_count( suffix_regex )
+	 - (int)open_groups.size() != group_count( regex ) ){
+      delete prefix_regex;
+      prefix_regex = 0;
+      delete suffix_regex;
+      suffix_regex = 0;
+      open_groups.clear();
+      return false;
+    }
+    return true;
   }
 
   ostream& operator<< (std::ostream& os, const Rule& r ){
-    if ( r.regexp ){
-      os << r.id << "=\"" << r.regexp->Pattern() << "\"";
+    if ( r.regex ){
+      os << r.id << "=\"" << r.pattern << "\"";
     }
     else
       os << r.id  << "=NULL";
     return os;
   }
 
-  bool Rule::matchAll( const UnicodeString& line,
-		       UnicodeString& pre,
-		       UnicodeString& post,
-		       vector<UnicodeString>& matches ){
+  RuleMatcher::RuleMatcher( const Rule& r ):
+    rule(r), tried(0), skipped(0), matcher(0), prefix(0), suffix(0) {
+    if ( rule.regex ){
+      UErrorCode u_stat = U_ZERO_ERROR;
+      matcher = rule.regex->matcher( u_stat );
+      if ( rule.isLookup() && U_SUCCESS(u_stat) ){
+	prefix = rule.prefix_regex->matcher( u_stat );
+	if ( U_SUCCESS(u_stat) ){
+	  suffix = rule.suffix_regex->matcher( u_stat );
+	}
+      }
+      if ( U_FAILURE(u_stat) ){
+	delete matcher;
+	delete prefix;
+	delete suffix;
+	throw runtime_error( "unable to create a matcher for rule: "
+			     + TiCC::UnicodeToUTF8(rule.id) );
+      }
+    }
+  }
+
+  RuleMatcher::~RuleMatcher(){
+    delete matcher;
+    delete prefix;
+    delete suffix;
+  }
+
+  static void set_region( RegexMatcher *m, int start, int end, bool anchor ){
+    // look at line[start,end), but let lookarounds see the rest too
+    UErrorCode u_stat = U_ZERO_ERROR;
+    m->region( start, end, u_stat );
+    m->useTransparentBounds( true );
+    m->useAnchoringBounds( anchor );
+  }
+
+  int RuleMatcher::lookup_match( const UnicodeString& line, bool split ){
+    // match line like the pattern of a lookup rule does, and when split is
+    // true, fill spans with the groups of the match.
+    // The match starts as far left as possible. So for every position
+    // where an abbreviation, and then the suffix, match, we look for the
+    // leftmost start of the prefix that ends there.
+    // returns 1 for a match and 0 for none. -1 means that the pattern
+    // itself must decide: when 2 positions have the same leftmost start,
+    // we don't know which one the regex would try first.
+    if ( rule.caseless
+	 && full_fold_set().span( line, 0, USET_SPAN_NOT_CONTAINED )
+	 < line.length() ){
+      return -1;
+    }
+    UErrorCode u_stat = U_ZERO_ERROR;
+    goods.clear();
+    suffix->reset( line );
+    for ( int q=0; q < line.length(); q = line.moveIndex32( q, 1 ) ){
+      rule.lookup->matches( line, q, rule.caseless, hits );
+      for ( const auto& hit : hits ){
+	// the regex tries the abbreviations in order
+	set_region( suffix, hit.second, line.length(), false );
+	if ( suffix->lookingAt( u_stat ) ){
+	  goods.push_back( make_pair( q, hit.second ) );
+	  break;
+	}
+      }
+    }
+    if ( goods.empty() ){
+      return 0;
+    }
+    int best = -1;
+    int best_start = line.length()+1;
+    bool tie = false;
+    prefix->reset( line );
+    for ( size_t i=0; i < goods.size(); ++i ){
+      set_region( prefix, 0, goods[i].first, true );
+      if ( prefix->find() ){
+	if ( !split ){
+	  return 1;
+	}
+	int start = prefix->start( u_stat );
+	if ( start < best_start ){
+	  best_start = start;
+	  best = i;
+	  tie = false;
+	}
+	else if ( start == best_start ){
+	  tie = true;
+	}
+      }
+    }
+    if ( best < 0 ){
+      return 0;
+    }
+    if ( tie ){
+      return -1;
+    }
+    // match the winners again, for their groups
+    set_region( prefix, 0, goods[best].first, true );
+    prefix->find();
+    set_region( suffix, goods[best].second, line.length(), false );
+    suffix->lookingAt( u_stat );
+    spans.assign( matcher->groupCount() + 1, make_pair( -1, -1 ) );
+    spans[0] = make_pair( best_start, suffix->end( u_stat ) );
+    for ( int g=1; g <= rule.prefix_groups; ++g ){
+      spans[g] = make_pair( prefix->start( g, u_stat ),
+			    prefix->end( g, u_stat ) );
+    }
+    int reopened = rule.open_groups.size();
+    for ( int g=1; g <= reopened; ++g ){
+      spans[rule.open_groups[g-1]].second = suffix->end( g, u_stat );
+    }
+    for ( int g=reopened+1; g <= suffix->groupCount(); ++g ){
+      spans[rule.prefix_groups + g - reopened]
+	= make_pair( suffix->start( g, u_stat ), suffix->end( g, u_stat ) );
+    }
+    return 1;
+  }
+
+  bool RuleMatcher::find( const UnicodeString& line ){
+    // check if the rule matches line
+    if ( rule.isLookup() ){
+      int found = lookup_match( line, false );
+      if ( found >= 0 ){
+	return found > 0;
+      }
+    }
+    matcher->reset( line );
+    return matcher->find();
+  }
+
+  bool RuleMatcher::match( const UnicodeString& line,
+			   RuleMatch& result ){
+    // match line, and fill result with the spans that matchAll() would
+    // return as strings.
+    if ( rule.isLookup() ){
+      int found = lookup_match( line, true );
+      if ( found > 0 ){
+	split_match( line, spans, result );
+      }
+      if ( found >= 0 ){
+	return found > 0;
+      }
+    }
+    matcher->reset( line );
+    if ( matcher->find() ){
+      get_spans( matcher, spans );
+      split_match( line, spans, result );
+      return true;
+    }
+    return false;
+  }
+
+  bool RuleMatcher::matchAll( const UnicodeString& line,
+			      UnicodeString& pre,
+			      UnicodeString& post,
+			      vector<UnicodeString>& matches ){
+    // match line with the full pattern, and return pre, post and the
+    // matched groups as copies
     matches.clear();
     pre = "";
     post = "";
 #ifdef MATCH_DEBUG
-    cerr << "match: " << id << endl;
+    cerr << "match: " << rule.id << endl;
 #endif
-    if ( regexp && regexp->match_all( line, pre, post ) ){
-      int num = regexp->NumOfMatches();
-      if ( num >=1 ){
-	for( int i=1; i <= num; ++i ){
-	  matches.push_back( regexp->get_match( i ) );
-	}
+    matcher->reset( line );
+    if ( matcher->find() ){
+      RuleMatch result;
+      get_spans( matcher, spans );
+      split_match( line, spans, result );
+      copy_match( line, result, pre, post, matches );
+      return true;
+    }
+    return false;
+  }
+
+  RuleMatchers::RuleMatchers( const vector<Rule *>& rules ){
+    // one matcher for every rule.
+    // Joining the rules into 1 alternation (rule1)|(rule2)|... is not an
+    // option: ICU then loses the start-of-match optimizations of the
+    // separate patterns, which makes it several times slower.
+    for ( const auto& rule : rules ){
+      _matchers.push_back( new RuleMatcher( *rule ) );
+    }
+  }
+
+  RuleMatchers::~RuleMatchers(){
+    for ( const auto& m : _matchers ){
+      delete m;
+    }
+  }
+
+  const Rule *RuleMatchers::matchFirst( const UnicodeString& line,
+					 RuleMatch& result ){
+    // return the first rule that matches line, and fill result with the
+    // spans that RuleMatcher::matchAll() would return as strings.
+    // Only the winning rule is split into its parts.
+    result.clear();
+    for ( const auto& m : _matchers ){
+      if ( !m->rule.mayMatch( line ) ){
+	++m->skipped;
+	continue;
       }
-      else {
-	matches.push_back( regexp->get_match( 0 ) );
+      ++m->tried;
+      if ( m->match( line, result ) ){
+	return &m->rule;
+      }
+    }
+    return 0;
+  }
+
+  const Rule *RuleMatchers::matchFirst( const UnicodeString& line,
+					 UnicodeString& pre,
+					 UnicodeString& post,
+					 vector<UnicodeString>& matches ){
+    // return the first rule that matches line, and fill pre, post and
+    // matches like RuleMatcher::matchAll() does.
+    matches.clear();
+    pre = "";
+    post = "";
+    RuleMatch result;
+    const Rule *rule = matchFirst( line, result );
+    if ( rule ){
+      copy_match( line, result, pre, post, matches );
+    }
+    return rule;
+  }
+
+  bool RuleMatchers::matchesAny( const UnicodeString& line,
+				  const vector<size_t>& selection ){
+    // check if any of the selected rules matches line
+    for ( const auto& i : selection ){
+      RuleMatcher *m = _matchers[i];
+      if ( !m->rule.mayMatch( line ) ){
+	++m->skipped;
+	continue;
+      }
+      ++m->tried;
+      if ( m->find( line ) ){
+	return true;
       }
-      return true;
     }
     return false;
   }
 
+  static bool matches_all_of( const UnicodeString& pattern, const UnicodeSet& chars ){
+    // check if pattern matches every non-empty string of characters from
+    // chars. We only recognize simple patterns like [\p{L}\p{Mn}]+
+    UnicodeString set_pat = pattern;
+    if ( set_pat.endsWith( "+" ) || set_pat.endsWith( "*" ) ){
+      set_pat.truncate( set_pat.length()-1 );
+    }
+    if ( !set_pat.startsWith( "\\p{" ) && !set_pat.startsWith( "\\P{" )
+	 && !( set_pat.startsWith( "[" ) && set_pat.endsWith( "]" ) ) ){
+      return false;
+    }
+    if ( set_pat[0] == '\\' ){
+      set_pat = "[" + set_pat + "]";
+    }
+    UErrorCode u_stat = U_ZERO_ERROR;
+    UnicodeSet set( set_pat, u_stat );
+    if ( U_FAILURE(u_stat) ){
+      return false;
+    }
+    return set.containsAll( chars );
+  }
+
+  void Setting::find_letter_rules( int tokDebug,
+				   TiCC::LogStream *theErrLog ){
+    // Find out if a word made of letters only can be anything else then
+    // a WORD. That is possible for rules before the WORD rule, when they
+    // might match such a word. When no rule might, the WORD rule must
+    // match every such word.
+    letter_path = false;
+    letter_rules.clear();
+    UErrorCode u_stat = U_ZERO_ERROR;
+    letters.applyPattern( "[\\p{L}]", u_stat );
+    letters.freeze();
+    for ( size_t i=0; i < rules.size(); ++i ){
+      if ( rules[i]->id == "WORD" ){
+	letter_path = matches_all_of( rules[i]->pattern, letters );
+	break;
+      }
+      if ( !rules[i]->excludes( letters ) ){
+	letter_rules.push_back( i );
+      }
+    }
+    if ( tokDebug ){
+      LOG << set_file << ": fast path for words of letters: "
+	  << ( letter_path ? "yes" : "no" ) << ", with "
+	  << letter_rules.size() << " rules to check" << endl;
+    }
+  }
+
   Setting::~Setting(){
     for ( const auto rule : rules ) {
       delete rule;
@@ -259,7 +1770,8 @@ namespace Tokenizer {
     return result;
   }
 
-  bool Setting::readrules( const string& fname ){
+  bool Setting::readrules( const string& fname,
+			 int tokDebug, TiCC::LogStream *theErrLog ){
     if ( tokDebug > 0 ){
       LOG << "%include " << fname << endl;
     }
@@ -290,14 +1802,16 @@ namespace Tokenizer {
     return true;
   }
 
-  bool Setting::readfilters( const string& fname ){
+  bool Setting::readfilters( const string& fname,
+			   int tokDebug, TiCC::LogStream *theErrLog ){
     if ( tokDebug > 0 ){
       LOG << "%include " << fname << endl;
     }
     return filter.fill( fname );
   }
 
-  bool Setting::readquotes( const string& fname ){
+  bool Setting::readquotes( const string& fname,
+			  int tokDebug, TiCC::LogStream *theErrLog ){
     if ( tokDebug > 0 ){
       LOG << "%include " << fname << endl;
     }
@@ -339,7 +1853,8 @@ namespace Tokenizer {
     return true;
   }
 
-  bool Setting::readeosmarkers( const string& fname ){
+  bool Setting::readeosmarkers( const string& fname,
+			      int tokDebug, TiCC::LogStream *theErrLog ){
     if ( tokDebug > 0 ){
       LOG << "%include " << fname << endl;
     }
@@ -401,7 +1916,8 @@ namespace Tokenizer {
   }
 
   bool Setting::readabbreviations( const string& fname,
-				   UnicodeString& abbreviations ){
+				   UnicodeString& pattern,
+				   int tokDebug, TiCC::LogStream *theErrLog ){
     if ( tokDebug > 0 ){
       LOG << "%include " << fname << endl;
     }
@@ -419,10 +1935,11 @@ namespace Tokenizer {
 	    LOG << "include line = " << rawline << endl;
 	  }
 	  line = escape_regex( line );
-	  if ( !abbreviations.isEmpty()){
-	    abbreviations += '|';
+	  if ( !pattern.isEmpty()){
+	    pattern += '|';
 	  }
-	  abbreviations += line;
+	  pattern += line;
+	  abbreviations.add( line );
 	}
       }
     }
@@ -438,8 +1955,25 @@ namespace Tokenizer {
     rulesmap[name] = new Rule( name, pat );
   }
 
+  void Setting::add_lookup_rule( const UnicodeString& name,
+				 const vector<UnicodeString>& before,
+				 const vector<UnicodeString>& after ){
+    // add a rule for before% ABBREVIATIONS %after, which looks the
+    // abbreviations up in the trie when that gives the same results
+    UnicodeString prefix;
+    for ( auto const& part : before ){
+      prefix += part;
+    }
+    UnicodeString suffix;
+    for ( auto const& part : after ){
+      suffix += part;
+    }
+    rulesmap[name] = new Rule( name, prefix, abbreviations, suffix );
+  }
+
   void Setting::sortRules( map<UnicodeString, Rule *>& rulesmap,
-			   const vector<UnicodeString>& sort ){
+			   const vector<UnicodeString>& sort,
+			   TiCC::LogStream *theErrLog ){
     // LOG << "rules voor sort : " << endl;
     // for ( size_t i=0; i < rules.size(); ++i ){
     //   LOG << "rule " << i << " " << *rules[i] << endl;
@@ -557,9 +2091,7 @@ namespace Tokenizer {
 
   bool Setting::read( const string& settings_name,
 		      const string& add_tokens,
-		      int dbg, TiCC::LogStream* ls ) {
-    tokDebug = dbg;
-    theErrLog = ls;
+		      int tokDebug, TiCC::LogStream *theErrLog ) {
     map<ConfigMode, UnicodeString> pattern = { { ABBREVIATIONS, "" },
 					       { TOKENS, "" },
 					       { PREFIXES, "" },
@@ -598,7 +2130,7 @@ namespace Tokenizer {
 	      file += ".rule";
 	    }
 	    file = get_filename( file );
-	    if ( !readrules( file ) ){
+	    if ( !readrules( file, tokDebug, theErrLog ) ){
 	      throw uConfigError( "'" + rawline + "' failed", set_file );
 	    }
 	  }
@@ -608,7 +2140,7 @@ namespace Tokenizer {
 	      file += ".filter";
 	    }
 	    file = get_filename( file );
-	    if ( !readfilters( file ) ){
+	    if ( !readfilters( file, tokDebug, theErrLog ) ){
 	      throw uConfigError( "'" + rawline + "' failed", set_file );
 	    }
 	  }
@@ -618,7 +2150,7 @@ namespace Tokenizer {
 	      file += ".quote";
 	    }
 	    file = get_filename( file );
-	    if ( !readquotes( file ) ){
+	    if ( !readquotes( file, tokDebug, theErrLog ) ){
 	      throw uConfigError( "'" + rawline + "' failed", set_file );
 	    }
 	  }
@@ -628,7 +2160,7 @@ namespace Tokenizer {
 	      file += ".eos";
 	    }
 	    file = get_filename( file );
-	    if ( !readeosmarkers( file ) ){
+	    if ( !readeosmarkers( file, tokDebug, theErrLog ) ){
 	      throw uConfigError( "'" + rawline + "' failed", set_file );
 	    }
 	  }
@@ -638,7 +2170,8 @@ namespace Tokenizer {
 	      file += ".abr";
 	    }
 	    file = get_filename( file );
-	    if ( !readabbreviations( file, pattern[ABBREVIATIONS] ) ){
+	    if ( !readabbreviations( file, pattern[ABBREVIATIONS],
+				     tokDebug, theErrLog ) ){
 	      throw uConfigError( "'" + rawline + "' failed", set_file );
 	    }
 	  }
@@ -680,6 +2213,8 @@ namespace Tokenizer {
 	      meta_rules.push_back( TiCC::UnicodeToUTF8(line) );
 	      break;
 	    case ABBREVIATIONS:
+	      abbreviations.add( line );
+	      // fallthrough
 	    case ATTACHEDPREFIXES:
 	    case ATTACHEDSUFFIXES:
 	    case PREFIXES:
@@ -805,9 +2340,13 @@ namespace Tokenizer {
 	vector<UnicodeString> new_parts;
 	vector<UnicodeString> undef_parts;
 	bool skip_rule = false;
+	int abbrev_part = -1; // the part holding the ABBREVIATIONS, if just 1
 	for ( const auto& part : parts ){
 	  UnicodeString meta = TiCC::UnicodeFromUTF8( part );
 	  ConfigMode local_mode = getMode( "[" + meta + "]" );
+	  if ( local_mode == ABBREVIATIONS ){
+	    abbrev_part = ( abbrev_part == -1 ? new_parts.size() : -2 );
+	  }
 	  switch ( local_mode ){
 	  case ORDINALS:
 	  case ABBREVIATIONS:
@@ -838,11 +2377,21 @@ namespace Tokenizer {
 	      << "', it mentions unknown pattern: '"
 	      << undef_parts <<"'" << endl;
 	}
+	else if ( abbrev_part >= 0
+		  && abbreviations.alternation() == new_parts[abbrev_part] ){
+	  add_lookup_rule( name,
+			   vector<UnicodeString>( new_parts.begin(),
+						  new_parts.begin() + abbrev_part ),
+			   vector<UnicodeString>( new_parts.begin() + abbrev_part + 1,
+						  new_parts.end() ) );
+	}
 	else {
 	  add_rule( name, new_parts );
 	}
       }
-      sortRules( rulesmap, rules_order );
+      sortRules( rulesmap, rules_order, theErrLog );
+      find_letter_rules( tokDebug, theErrLog );
+      chars.build( quotes );
     }
     else {
       return false;
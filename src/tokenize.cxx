@@ -26,15 +26,29 @@
 */
 
 #include "ucto/tokenize.h"
+#include "pipeline.h"
 
 #include <cassert>
 #include <unistd.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <exception>
 #include "config.h"
 #include "unicode/schriter.h"
 #include "unicode/ucnv.h"
+#include "unicode/ustring.h"
+#include "unicode/utf16.h"
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "ticcutils/StringOps.h"
 #include "ticcutils/PrettyPrint.h"
 #include "ticcutils/Unicode.h"
@@ -95,9 +109,16 @@ namespace Tokenizer {
 
 
   UnicodeString convert( const string& line,
-			 const string& inputEncoding ){
+			 const string& inputEncoding,
+			 bool utf8 ){
+    // utf8 tells that inputEncoding is a name of UTF-8
     UnicodeString result;
     if ( !line.empty() ){
+      if ( utf8 ){
+	// decode directly, without opening a converter for every line.
+	// invalid bytes become U+FFFD, just like the converter does
+	return UnicodeString::fromUTF8( line );
+      }
       try {
 	result = UnicodeString( line.c_str(),
 				line.length(),
@@ -116,6 +137,212 @@ namespace Tokenizer {
     return result;
   }
 
+  const size_t read_chunk = 65536; // bytes the LineReader reads at once
+
+  void LineReader::open_converter( const string& enc ){
+    UErrorCode err = U_ZERO_ERROR;
+    converter = ucnv_open( enc.c_str(), &err );
+    if ( U_FAILURE( err ) ){
+      converter = 0;
+      throw uCodingError( "string decoding failed: (invalid inputEncoding '"
+			  + enc + "' ?)" );
+    }
+    encoding = enc;
+  }
+
+  void LineReader::open( istream& is, const string& enc ){
+    close();
+    open_converter( enc );
+    in = &is;
+    line_mode = ( &is == &cin );
+    if ( !line_mode ){
+      bytes.resize( read_chunk );
+    }
+    // read the start of the stream, to find the BOM
+    fill( true );
+  }
+
+  bool LineReader::map( const string& file, const string& enc ){
+    // map a regular file in memory, and read from there.
+    // false when that isn't possible. (pipes, devices, no mmap)
+    close();
+#ifdef HAVE_MMAP
+    int fd = ::open( file.c_str(), O_RDONLY );
+    if ( fd < 0 ){
+      return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0
+	 || !S_ISREG( st.st_mode )
+	 || st.st_size == 0 ){
+      ::close( fd );
+      return false;
+    }
+    void *addr = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd ); // the mapping stays valid
+    if ( addr == MAP_FAILED ){
+      return false;
+    }
+    madvise( addr, st.st_size, MADV_SEQUENTIAL );
+    mapped = static_cast<const char*>( addr );
+    mapped_size = st.st_size;
+    mapped_pos = 0;
+    unmap = true;
+    open_converter( enc );
+    fill( true );
+    return true;
+#else
+    (void)file;
+    (void)enc;
+    return false;
+#endif
+  }
+
+  void LineReader::open( const char *text, size_t size, const string& enc ){
+    close();
+    // an empty text still needs a pointer, or fill() takes us for a stream
+    mapped = size > 0 ? text : "";
+    mapped_size = size;
+    mapped_pos = 0;
+    open_converter( enc );
+    fill( true );
+  }
+
+  void LineReader::close(){
+    if ( converter ){
+      ucnv_close( converter );
+      converter = 0;
+    }
+#ifdef HAVE_MMAP
+    if ( mapped && unmap ){
+      munmap( const_cast<char*>( mapped ), mapped_size );
+    }
+#endif
+    mapped = 0;
+    mapped_size = 0;
+    mapped_pos = 0;
+    unmap = false;
+    in = 0;
+    buffer.remove();
+    pos = 0;
+    at_end = false;
+  }
+
+  void LineReader::detect_bom( const char*& source, const char *source_end ){
+    // a BOM at the start of the stream determines the encoding
+    UErrorCode err = U_ZERO_ERROR;
+    int32_t bom_length = 0;
+    const char *enc = ucnv_detectUnicodeSignature( source,
+						   source_end - source,
+						   &bom_length, &err );
+    if ( U_SUCCESS( err ) && bom_length > 0 ){
+      UConverter *conv = ucnv_open( enc, &err );
+      if ( U_SUCCESS( err ) ){
+	ucnv_close( converter );
+	converter = conv;
+	encoding = enc;
+	source += bom_length;
+      }
+    }
+  }
+
+  void LineReader::fill( bool first ){
+    // decode the next chunk of the stream, and append it to the buffer
+    const char *source;
+    const char *source_end;
+    if ( mapped ){
+      // decode straight from the mapped file
+      size_t len = min( read_chunk, mapped_size - mapped_pos );
+      source = mapped + mapped_pos;
+      source_end = source + len;
+      mapped_pos += len;
+      at_end = ( mapped_pos == mapped_size );
+    }
+    else if ( line_mode ){
+      // don't wait for more input than needed
+      at_end = !std::getline( *in, raw );
+      if ( at_end ){
+	raw.clear();
+      }
+      else if ( !in->eof() ){
+	raw += '\n';
+      }
+      source = raw.data();
+      source_end = source + raw.size();
+    }
+    else {
+      in->read( &bytes[0], bytes.size() );
+      source = &bytes[0];
+      source_end = source + in->gcount();
+      at_end = !*in;
+    }
+    if ( first ){
+      detect_bom( source, source_end );
+    }
+    UErrorCode err;
+    do {
+      err = U_ZERO_ERROR;
+      int32_t len = buffer.length();
+      int32_t capacity = len + ( source_end - source ) + 16;
+      UChar *begin = buffer.getBuffer( capacity );
+      UChar *target = begin + len;
+      ucnv_toUnicode( converter,
+		      &target, begin + capacity,
+		      &source, source_end,
+		      0, at_end, &err );
+      buffer.releaseBuffer( target - begin );
+    } while ( err == U_BUFFER_OVERFLOW_ERROR );
+    if ( U_FAILURE( err ) ){
+      throw uCodingError( "Unexpected character found in input. "
+			  + string( u_errorName( err ) )
+			  + " Make sure input is valid: " + encoding );
+    }
+  }
+
+  bool LineReader::interactive() const {
+    // are we reading from a terminal?
+    return line_mode && isatty( 0 );
+  }
+
+  bool LineReader::getline( UnicodeString& line ){
+    // get the next line, without the line end.
+    // returns false at the end of the stream
+    if ( !converter ){
+      // not open
+      return false;
+    }
+    // where to look for the line end. After a refill only the new part
+    // is searched, so a long line isn't rescanned for every chunk
+    int32_t scanned = pos;
+    while ( true ){
+      int32_t nl = buffer.indexOf( (UChar)'\n', scanned );
+      if ( nl >= 0 ){
+	line.setTo( buffer, pos, nl - pos );
+	pos = nl + 1;
+	break;
+      }
+      if ( at_end ){
+	if ( pos >= buffer.length() ){
+	  line.remove();
+	  return false;
+	}
+	// a last line without a line end
+	line.setTo( buffer, pos );
+	pos = buffer.length();
+	break;
+      }
+      // keep the start of the line, and decode some more
+      buffer.remove( 0, pos );
+      pos = 0;
+      scanned = buffer.length();
+      fill( false );
+    }
+    if ( !line.isEmpty() && line[line.length()-1] == '\r' ){
+      line.truncate( line.length()-1 );
+    }
+    return true;
+  }
+
   const UnicodeString type_space = "SPACE";
   const UnicodeString type_currency = "CURRENCY";
   const UnicodeString type_emoticon = "EMOTICON";
@@ -142,23 +369,66 @@ namespace Tokenizer {
     return os;
   }
 
+  const int printed_roles = NOSPACE | BEGINOFSENTENCE | ENDOFSENTENCE
+    | NEWPARAGRAPH | BEGINQUOTE | ENDQUOTE;
+
+  vector<string> make_role_names(){
+    // the printed form of every combination of the printed roles
+    vector<string> result( printed_roles + 1 );
+    for ( int tok = 0; tok <= printed_roles; ++tok ){
+      string& name = result[tok];
+      if ( tok & NOSPACE) name += "NOSPACE ";
+      if ( tok & BEGINOFSENTENCE) name += "BEGINOFSENTENCE ";
+      if ( tok & ENDOFSENTENCE) name += "ENDOFSENTENCE ";
+      if ( tok & NEWPARAGRAPH) name += "NEWPARAGRAPH ";
+      if ( tok & BEGINQUOTE) name += "BEGINQUOTE ";
+      if ( tok & ENDQUOTE) name += "ENDQUOTE ";
+    }
+    return result;
+  }
+
+  const string& role_string( TokenRole tok ){
+    static const vector<string> names = make_role_names();
+    return names[tok & printed_roles];
+  }
+
   ostream& operator<<( ostream& os, const TokenRole& tok ){
-    if ( tok & NOSPACE) os << "NOSPACE ";
-    if ( tok & BEGINOFSENTENCE) os << "BEGINOFSENTENCE ";
-    if ( tok & ENDOFSENTENCE) os << "ENDOFSENTENCE ";
-    if ( tok & NEWPARAGRAPH) os << "NEWPARAGRAPH ";
-    if ( tok & BEGINQUOTE) os << "BEGINQUOTE ";
-    if ( tok & ENDQUOTE) os << "ENDQUOTE ";
+    os << role_string( tok );
     return os;
   }
 
+  void Utf8Writer::put( const UnicodeString& us ){
+    // encode straight into the buffer. A UTF-16 unit takes at most 3 bytes
+    const size_t len = buffer.size();
+    const int32_t capacity = 3 * us.length();
+    buffer.resize( len + capacity );
+    int32_t written = 0;
+    UErrorCode err = U_ZERO_ERROR;
+    u_strToUTF8WithSub( &buffer[len], capacity, &written,
+			us.getBuffer(), us.length(),
+			0xFFFD, 0, &err );
+    buffer.resize( len + written );
+    check();
+  }
+
   TokenizerClass::TokenizerClass():
     linenum(0),
     inputEncoding( "UTF-8" ),
+    utf8_input( true ),
     eosmark("<utt>"),
+    reader( new LineReader() ),
+    chunk_lines( 0 ),
+    chunk_pos( 0 ),
+    chunk_source( 0 ),
+    source_chunk( new ParagraphChunk() ),
+    tokens_offset( 0 ),
+    word_cache( 10000 ),
+    model(0),
+    own_model(false),
     tokDebug(0),
     verbose(false),
     detectQuotes(false),
+    quote_lookback(0),
     doFilter(true),
     doPunctFilter(false),
     doWordCorrection(true),
@@ -167,6 +437,7 @@ namespace Tokenizer {
     paragraphsignal(true),
     paragraphsignal_next(false),
     doDetectLang(false),
+    tc_debug(false),
     text_redundancy("minimal"),
     sentenceperlineoutput(false),
     sentenceperlineinput(false),
@@ -175,65 +446,72 @@ namespace Tokenizer {
     xmlout(false),
     xmlin(false),
     passthru(false),
+    span_matching(true),
+    letter_path(true),
     ignore_tag_hints(false),
     ucto_processor(0),
     already_tokenized(false),
     inputclass("current"),
-    outputclass("current"),
-    text_cat( 0 )
+    outputclass("current")
   {
     theErrLog = new TiCC::LogStream(cerr, "ucto" );
     theErrLog->setstamp( StampMessage );
-#ifdef HAVE_TEXTCAT
-    string textcat_cfg = string(SYSCONF_PATH) + "/ucto/textcat.cfg";
-    text_cat = new TextCat( textcat_cfg, theErrLog );
-    //    text_cat->set_debug( true );
-    LOG << " textcat configured from: " << textcat_cfg << endl;
-    // ifstream is( textcat_cfg );
-    // string line;
-    // while ( getline( is, line ) ){
-    //   LOG << line << endl;
-    //   vector<string> v = TiCC::split( line );
-    //   if ( v.size()==2 && v[1] == "nld" ){
-    // 	LOG << "voor nederlands: " << endl;
-    //     ifstream is2( v[0] );
-    // 	string line2;
-    // 	while ( getline( is2, line2 ) ){
-    // 	  LOG << line2 << endl;
-    // 	  break;
-    // 	}
-    // 	LOG << "   done with nederlands" << endl;
-    //   }
-    // }
-#else
-    LOG << "NO TEXTCAT SUPPORT!" << endl;
-#endif
   }
 
   TokenizerClass::~TokenizerClass(){
-    Setting *d = 0;
+    clear_model();
+    delete reader;
+    delete source_chunk;
+    delete theErrLog;
+  }
+
+
+  void TokenizerClass::clear_model(){
+    set<SettingState*> done; // aliases share their state
     for ( const auto& s : settings ){
-      if ( s.first == "default" ){
-	// the 'default' may also return as a real 'language'
-	// avoid deleting it twice
-	d = s.second;
-	delete d;
-      }
-      if ( s.second != d ){
+      if ( done.insert( s.second ).second ){
 	delete s.second;
       }
-
     }
-    delete theErrLog;
-    delete text_cat;
+    settings.clear();
+    if ( own_model ){
+      delete model;
+    }
+    model = 0;
+    own_model = false;
+  }
+
+  void TokenizerClass::set_model( const TokenizerModel *m, bool own ){
+    // start using model m. Every Setting gets a fresh state
+    clear_model();
+    model = m;
+    own_model = own;
+    map<const Setting*,SettingState*> states;
+    for ( const auto& it : model->settings() ){
+      SettingState*& state = states[it.second];
+      if ( state == 0 ){
+	state = new SettingState( it.second );
+      }
+      settings[it.first] = state;
+    }
+    default_language = model->default_language();
+    data_version = get_data_version();
+    word_cache.clear();
   }
 
-  bool TokenizerClass::reset( const string& lang ){
+  bool TokenizerClass::reset( const string& ){
     ucto_processor = 0;
     already_tokenized = false;
     tokens.clear();
-    if ( settings.find("lang") != settings.end() ){
-      settings[lang]->quotes.clearStack();
+    tokens_offset = 0;
+    linenum = 0;
+    paragraphsignal = true;
+    paragraphsignal_next = false;
+    scan.reset( 0 );
+    quote_marks.clear();
+    reader->close();
+    for ( const auto& s : settings ){
+      s.second->quotes.clear();
     }
     return true;
   }
@@ -243,12 +521,12 @@ namespace Tokenizer {
     for ( const auto& val : parts ){
       norm_set.insert( TiCC::UnicodeFromUTF8( val ) );
     }
+    word_cache.clear();
     return true;
   }
 
   void TokenizerClass::setErrorLog( TiCC::LogStream *os ) {
     if ( theErrLog != os ){
-      text_cat->set_debug_stream( os );
       delete theErrLog;
     }
     theErrLog = os;
@@ -257,6 +535,7 @@ namespace Tokenizer {
   string TokenizerClass::setInputEncoding( const std::string& enc ){
     string old = inputEncoding;
     inputEncoding = enc;
+    utf8_input = ( ucnv_compareNames( enc.c_str(), "UTF-8" ) == 0 );
     return old;
   }
 
@@ -273,37 +552,12 @@ namespace Tokenizer {
   }
 
   bool TokenizerClass::set_tc_debug( bool b ){
-    if ( !text_cat ){
+    if ( !textcat() ){
       throw logic_error( "attempt to set debug on uninitialized TextClass object" );
     }
-    else {
-      return text_cat->set_debug( b );
-    }
-  }
-
-  string fixup_UTF16( const string& input_line, const string& encoding ){
-    string line = input_line;
-    // some hackery to handle exotic input. UTF-16 but also CR at end.
-    string::size_type pos = line.rfind( '\r' );
-    if ( pos != string::npos ){
-      line.erase( pos );
-    }
-    if ( line.size() > 0 && line[0] == 0 ){
-      // when processing UTF16LE, '0' bytes show up at pos 0
-      // we discard them, not for UTF16BE!
-      // this works on Linux with GCC (atm)
-      if ( encoding != "UTF16BE" ){
-	line.erase(0,1);
-      }
-    }
-    if ( line.size() > 0 && encoding == "UTF16BE" &&
-	 line.back() == 0 ){
-      // when processing UTF16BE, '0' bytes show up at the end
-      // we discard them.
-      // this works on Linux with GCC (atm)
-      line.erase(line.size()-1);
-    }
-    return line;
+    bool t = tc_debug;
+    tc_debug = b;
+    return t;
   }
 
   folia::processor *TokenizerClass::init_provenance( folia::Document *doc,
@@ -454,10 +708,10 @@ namespace Tokenizer {
 	  continue;
 	}
 	folia::KWargs args;
-	args["name"] = s.second->set_file;
+	args["name"] = s.second->setting->set_file;
 	args["generate_id"] = "next()";
 	args["type"] = "datasource";
-	args["version"] = s.second->version;
+	args["version"] = s.second->setting->version;
 	doc->add_processor( args, data_proc );
 	args.clear();
 	args["processor"] = proc->id();
@@ -510,9 +764,9 @@ namespace Tokenizer {
       if ( language.empty() ){
 	if ( tokDebug > 3 ){
 	  LOG << "should we guess the language? "
-	      << (text_cat && doDetectLang) << endl;
+	      << doDetectLang << endl;
 	}
-	if ( text_cat && doDetectLang ){
+	if ( doDetectLang && textcat() ){
 	  UnicodeString temp = input_line;
 	  temp.findAndReplace( eosmark, "" );
 	  temp.toLower();
@@ -520,7 +774,8 @@ namespace Tokenizer {
 	    LOG << "use textCat to guess language from: "
 		<< temp << endl;
 	  }
-	  language = text_cat->get_language( TiCC::UnicodeToUTF8(temp) );
+	  language = textcat()->get_language( TiCC::UnicodeToUTF8(temp),
+					      tc_debug ? theErrLog : 0 );
 	  if ( settings.find( language ) != settings.end() ){
 	    if ( tokDebug > 3 ){
 	      LOG << "found a supported language: " << language << endl;
@@ -538,7 +793,63 @@ namespace Tokenizer {
     }
   }
 
+  void TokenizerClass::attach( istream& IN ){
+    // take our input from IN, unless we already do
+    if ( !reader->is_open( IN ) ){
+      reader->open( IN, inputEncoding );
+      if ( tokDebug && reader->get_encoding() != inputEncoding ){
+	LOG << "Autodetected encoding: " << reader->get_encoding() << endl;
+      }
+    }
+  }
+
+  bool TokenizerClass::attach( const string& file ){
+    // take our input from a memory mapped file. false if it can't be mapped
+    if ( !reader->map( file, inputEncoding ) ){
+      return false;
+    }
+    if ( tokDebug && reader->get_encoding() != inputEncoding ){
+      LOG << "Autodetected encoding: " << reader->get_encoding() << endl;
+    }
+    return true;
+  }
+
   vector<Token> TokenizerClass::tokenizeOneSentence( istream& IN ){
+    attach( IN );
+    return next_sentence();
+  }
+
+  bool TokenizerClass::next_line( UnicodeString& line ){
+    // get the next input line: from the chunk we are working on, if any,
+    // or else from the attached input, which is closed at the end
+    if ( chunk_lines ){
+      while ( chunk_pos >= chunk_lines->size() ){
+	// tokenize_lines() goes on with the next chunk, if any
+	if ( !chunk_source || !chunk_source->pop( *source_chunk ) ){
+	  return false;
+	}
+	chunk_lines = &source_chunk->lines;
+	chunk_pos = 0;
+      }
+      line = (*chunk_lines)[chunk_pos++];
+      return true;
+    }
+    if ( reader->getline( line ) ){
+      return true;
+    }
+    reader->close();
+    return false;
+  }
+
+  vector<Token> TokenizerClass::next_sentence(){
+    vector<Token> result;
+    next_sentence( result );
+    return result;
+  }
+
+  bool TokenizerClass::next_sentence( vector<Token>& result ){
+    // get the next sentence from the attached input, in result.
+    // false at the end of the input
     if  (tokDebug > 0) {
       LOG << "[tokenizeOneSentence()] before countSent " << endl;
     }
@@ -548,31 +859,22 @@ namespace Tokenizer {
 	LOG << "[tokenizeOneSentence] " << numS
 	    << " sentence(s) in buffer, processing..." << endl;
       }
-      return popSentence( );
+      return pop_sentence( result );
     }
     if  (tokDebug > 0) {
       LOG << "[tokenizeOneSentence] NO sentences in buffer, searching.." << endl;
     }
     bool done = false;
     bool bos = true;
-    inputEncoding = checkBOM( IN );
-    string line;
+    UnicodeString input_line;
     do {
-      done = !getline( IN, line );
-      UnicodeString input_line;
+      done = !next_line( input_line );
       if ( !done ){
 	++linenum;
 	if (tokDebug > 0) {
 	  LOG << "[tokenize] Read input line " << linenum
-	      << "-: '" << TiCC::format_nonascii( line ) << "'" << endl;
+	      << "-: '" << input_line << "'" << endl;
 	}
-	string tmp_line = fixup_UTF16( line, inputEncoding );
-	if ( tokDebug > 0
-	     && tmp_line != line ){
-	  LOG << "After fixup, input_line= '"
-	      << TiCC::format_nonascii( tmp_line ) << "'" << endl;
-	}
-	input_line = convert( tmp_line, inputEncoding );
 	if ( sentenceperlineinput ){
 	  input_line += " " + eosmark;
 	}
@@ -587,7 +889,7 @@ namespace Tokenizer {
 	// setting explicit END_OF_SENTENCE
       }
       else {
-	tokenize_one_line( input_line, bos );
+	tokenize_one_line( input_line, bos, text_language );
 	numS = countSentences(); //count full sentences in token buffer
       }
       if ( numS > 0 ) {
@@ -596,7 +898,7 @@ namespace Tokenizer {
 	if  (tokDebug > 0) {
 	  LOG << "[tokenizeOneSentence] " << numS << " sentence(s) in buffer, processing first one..." << endl;
 	}
-	return popSentence();
+	return pop_sentence( result );
       }
       else {
 	if  (tokDebug > 0) {
@@ -604,29 +906,35 @@ namespace Tokenizer {
 	}
       }
     } while (!done);
-    vector<Token> result;
-    return result;
+    result.clear();
+    return false;
   }
 
   folia::Document *TokenizerClass::tokenize( istream& IN ) {
-    inputEncoding = checkBOM( IN );
+    attach( IN );
+    return sentences_to_folia();
+  }
+
+  folia::Document *TokenizerClass::sentences_to_folia(){
+    // tokenize the attached input to a new FoLiA document
     folia::Document *doc = start_document( docid );
     folia::FoliaElement *root = doc->doc()->index(0);
     int parCount = 0;
     vector<Token> buffer;
-    do {
+    while ( true ){
       if ( tokDebug > 0 ){
 	LOG << "[tokenize] looping on stream" << endl;
       }
-      vector<Token> v = tokenizeOneSentence( IN );
-      if ( !v.empty() ){
-	if ( tokDebug > 1 ){
-	  LOG << "[tokenize] sentence=" << v << endl;
-	}
-	root = append_to_folia( root, v, parCount );
+      // the input is read ahead, so go on until no more sentences are found
+      vector<Token> v = next_sentence();
+      if ( v.empty() ){
+	break;
+      }
+      if ( tokDebug > 1 ){
+	LOG << "[tokenize] sentence=" << v << endl;
       }
+      root = append_to_folia( root, v, parCount );
     }
-    while ( IN );
     if ( tokDebug > 0 ){
       LOG << "[tokenize] end of stream reached" << endl;
     }
@@ -647,28 +955,483 @@ namespace Tokenizer {
       OUT = new ofstream( ofile );
     }
 
-    istream *IN = NULL;
     if ( xmlin ){
       folia::Document *doc = tokenize_folia( ifile );
       *OUT << *doc;
       OUT->flush();
       delete doc;
     }
+    else if ( ifile.empty() ){
+      this->tokenize( cin, *OUT );
+    }
     else {
-      if ( ifile.empty() )
-	IN = &cin;
+      this->tokenize( ifile, *OUT );
+    }
+    if ( OUT != &cout ) delete OUT;
+  }
+
+  void TokenizerClass::tokenize( const string& ifile, ostream& OUT ){
+    // tokenize a text file. A regular file is memory mapped, others (like
+    // pipes) are read as a stream
+    if ( !attach( ifile ) ){
+      ifstream IN( ifile );
+      if ( !IN.good() ){
+	cerr << "ucto: problems opening inputfile " << ifile << endl;
+	cerr << "ucto: Courageously refusing to start..."  << endl;
+	throw runtime_error( "unable to find or read file: '" + ifile + "'" );
+      }
+      this->tokenize( IN, OUT );
+    }
+    else if ( xmlout ){
+      folia::Document *doc = sentences_to_folia();
+      OUT << doc;
+      OUT.flush();
+      delete doc;
+    }
+    else {
+      sentences_to_stream( OUT );
+    }
+  }
+
+  void TokenizerClass::tokenize( istream& IN, SentenceSink& sink ){
+    attach( IN );
+    vector<Token> v; // reused for every sentence
+    while ( next_sentence( v ) ){
+      if ( detectPar && ( v[0].role & NEWPARAGRAPH ) ){
+	sink.paragraph();
+      }
+      sink.sentence( v );
+    }
+    sink.end_of_document();
+  }
+
+  void TokenizerClass::sentences_to_stream( ostream& OUT ){
+    // tokenize the attached input to OUT
+    Utf8Writer out( OUT );
+    // someone is typing, show the results right away
+    const bool interactive = reader->interactive();
+    int i = 0;
+    if ( tokDebug > 0 ){
+      LOG << "[tokenize] looping on stream" << endl;
+    }
+    vector<Token> v; // reused for every sentence
+    while ( next_sentence( v ) ){
+      outputTokens( out, v , (i>0) );
+      if ( interactive ){
+	out.flush();
+      }
+      ++i;
+    }
+    if ( tokDebug > 0 ){
+      LOG << "[tokenize] end_of_stream" << endl;
+    }
+    out.put( '\n' );
+    out.flush();
+  }
+
+  bool TokenizerClass::parallel_ok() const {
+    // can tokenize_parallel() split the input at empty lines?
+    // That is the case when an empty line ends all sentences, and leaves
+    // no state behind for the next paragraph.
+    // (with -m every line gets an EOS marker, so no line is empty, and the
+    // quote stacks of all other languages than that of the last sentence
+    // survive a paragraph)
+    return !xmlout
+      && !sentenceperlineinput
+      && !( doDetectLang && detectQuotes );
+  }
+
+  void TokenizerClass::tokenize_chunk( ParagraphChunk& chunk ){
+    // tokenize the lines of chunk, as if they followed an empty line
+    chunk_lines = &chunk.lines;
+    chunk_pos = 0;
+    linenum = chunk.first_line;
+    paragraphsignal = true;
+    paragraphsignal_next = false;
+    chunk.first.clear();
+    chunk.first_length = 0;
+    ostringstream os;
+    {
+      Utf8Writer out( os );
+      vector<Token> v = next_sentence();
+      if ( !v.empty() ){
+	// the first sentence is only continued when an earlier chunk has
+	// output. So keep both versions
+	ostringstream first_os;
+	{
+	  Utf8Writer first( first_os );
+	  outputTokens( first, v, false );
+	}
+	chunk.first = first_os.str();
+	outputTokens( out, v, true );
+	out.flush();
+	chunk.first_length = os.tellp();
+      }
+      while ( !v.empty() ){
+	v = next_sentence();
+	if ( !v.empty() ){
+	  outputTokens( out, v, true );
+	}
+      }
+    }
+    chunk.output = os.str();
+    chunk_lines = 0;
+  }
+
+  void TokenizerClass::read_chunks( ChunkQueues& chunks,
+				   size_t chunk_size,
+				   bool at_paragraphs ){
+    // the reader stage of the pipeline: read the attached input in chunks
+    // of chunk_size lines. With at_paragraphs, a chunk is only cut at an
+    // empty line, so it holds whole paragraphs.
+    // The chunks are dealt out to the queues of the stages in turn
+    int lines_read = 0;
+    size_t number = 0;
+    bool done = false;
+    while ( !done ){
+      ParagraphChunk chunk;
+      chunk.first_line = lines_read;
+      UnicodeString line;
+      while ( true ){
+	if ( !reader->getline( line ) ){
+	  reader->close();
+	  done = true;
+	  break;
+	}
+	++lines_read;
+	if ( at_paragraphs && line.isEmpty() ){
+	  if ( chunk.lines.size() >= chunk_size ){
+	    break;
+	  }
+	  if ( chunk.lines.empty() ){
+	    // leading empty lines don't matter
+	    ++chunk.first_line;
+	    continue;
+	  }
+	}
+	chunk.lines.push_back( line );
+	if ( !at_paragraphs && chunk.lines.size() >= chunk_size ){
+	  break;
+	}
+      }
+      if ( !chunk.lines.empty() ){
+	chunk.number = number++;
+	if ( !chunks[chunk.number % chunks.size()].push( std::move( chunk ) ) ){
+	  // the pipeline is stopped
+	  break;
+	}
+      }
+    }
+    for ( auto& queue : chunks ){
+      queue.close();
+    }
+  }
+
+  void TokenizerClass::tokenize_paragraphs( ChunkQueue& in, ChunkQueue& out ){
+    // a tokenizer stage of the pipeline: tokenize the chunks of whole
+    // paragraphs from in, and pass them on to out
+    ParagraphChunk chunk;
+    while ( in.pop( chunk ) ){
+      tokenize_chunk( chunk );
+      chunk.lines.clear();
+      if ( !out.push( std::move( chunk ) ) ){
+	break;
+      }
+    }
+    out.close();
+  }
+
+  void TokenizerClass::tokenize_lines( ChunkQueue& in, ChunkQueue& out ){
+    // the only tokenizer stage of the pipeline: tokenize the chunks from in
+    // as one text, just like sentences_to_stream() does. The output is
+    // passed on to out in pieces of about Utf8Writer's buffer size
+    chunk_source = &in;
+    source_chunk->lines.clear();
+    chunk_lines = &source_chunk->lines;
+    chunk_pos = 0;
+    size_t number = 0;
+    ostringstream os;
+    auto pass_on = [&](){
+      ParagraphChunk piece;
+      piece.number = number++;
+      piece.output = os.str();
+      os.str( "" );
+      return out.push( std::move( piece ) );
+    };
+    {
+      Utf8Writer writer( os );
+      int i = 0;
+      vector<Token> v; // reused for every sentence
+      while ( next_sentence( v ) ){
+	outputTokens( writer, v , (i>0) );
+	++i;
+	if ( os.tellp() > 0 && !pass_on() ){
+	  break;
+	}
+      }
+    }
+    if ( os.tellp() > 0 ){
+      pass_on();
+    }
+    out.close();
+    chunk_source = 0;
+    chunk_lines = 0;
+  }
+
+  void TokenizerClass::write_chunks( ChunkQueues& chunks, Utf8Writer& out ){
+    // the writer stage of the pipeline: write the output of the chunks in
+    // input order. The reader dealt them out to the stages in turn, so
+    // chunk n comes out of queue n % chunks.size()
+    size_t next = 0;
+    bool started = false; // has a sentence been output?
+    ParagraphChunk chunk;
+    while ( chunks[next % chunks.size()].pop( chunk ) ){
+      assert( chunk.number == next );
+      if ( !chunk.output.empty() ){
+	if ( started ){
+	  out.put( chunk.output );
+	}
+	else {
+	  out.put( chunk.first );
+	  out.put( chunk.output.substr( chunk.first_length ) );
+	  started = true;
+	}
+      }
+      ++next;
+    }
+  }
+
+  void TokenizerClass::tokenize_parallel( const string& ifile,
+					  ostream& OUT,
+					  const vector<TokenizerClass*>& helpers,
+					  size_t chunk_size ){
+    if ( xmlout ){
+      if ( ifile.empty() ){
+	tokenize( cin, OUT );
+      }
       else {
-	IN = new ifstream( ifile );
-	if ( !IN || !IN->good() ){
-	  cerr << "ucto: problems opening inputfile " << ifile << endl;
-	  cerr << "ucto: Courageously refusing to start..."  << endl;
-	  throw runtime_error( "unable to find or read file: '" + ifile + "'" );
+	tokenize( ifile, OUT );
+      }
+      return;
+    }
+    ifstream IN;
+    if ( ifile.empty() ){
+      attach( cin );
+    }
+    else if ( !attach( ifile ) ){
+      IN.open( ifile );
+      if ( !IN.good() ){
+	cerr << "ucto: problems opening inputfile " << ifile << endl;
+	cerr << "ucto: Courageously refusing to start..."  << endl;
+	throw runtime_error( "unable to find or read file: '" + ifile + "'" );
+      }
+      attach( IN );
+    }
+    if ( reader->interactive() ){
+      // no use waiting for the chunks to fill up
+      sentences_to_stream( OUT );
+      return;
+    }
+    vector<TokenizerClass*> stages( 1, this );
+    const bool at_paragraphs = !helpers.empty() && parallel_ok();
+    if ( at_paragraphs ){
+      stages.insert( stages.end(), helpers.begin(), helpers.end() );
+    }
+    // every tokenizer stage has a queue from the reader and one to the
+    // writer. They are small: a slow output blocks all stages before it
+    ChunkQueues input;
+    ChunkQueues output;
+    for ( size_t i=0; i < stages.size(); ++i ){
+      input.emplace_back( 2 );
+      output.emplace_back( 2 );
+    }
+    exception_ptr error;
+    mutex error_mutex;
+    auto stop = [&](){
+      // a stage failed. Keep the first error, and stop the others
+      {
+	lock_guard<mutex> lock( error_mutex );
+	if ( !error ){
+	  error = current_exception();
 	}
       }
-      this->tokenize( *IN, *OUT );
+      for ( size_t i=0; i < stages.size(); ++i ){
+	input[i].close();
+	output[i].close();
+      }
+    };
+    thread reader_thread( [&](){
+	try {
+	  read_chunks( input, chunk_size, at_paragraphs );
+	}
+	catch ( ... ){
+	  stop();
+	}
+      } );
+    vector<thread> threads;
+    for ( size_t i=0; i < stages.size(); ++i ){
+      threads.push_back( thread( [&,i](){
+	    try {
+	      if ( at_paragraphs ){
+		stages[i]->tokenize_paragraphs( input[i], output[i] );
+	      }
+	      else {
+		stages[i]->tokenize_lines( input[i], output[i] );
+	      }
+	    }
+	    catch ( ... ){
+	      stop();
+	    }
+	  } ) );
     }
-    if ( IN != &cin ) delete IN;
-    if ( OUT != &cout ) delete OUT;
+    Utf8Writer out( OUT );
+    try {
+      write_chunks( output, out );
+    }
+    catch ( ... ){
+      stop();
+    }
+    reader_thread.join();
+    for ( auto& t : threads ){
+      t.join();
+    }
+    if ( error ){
+      rethrow_exception( error );
+    }
+    out.put( '\n' );
+    out.flush();
+  }
+
+  void TokenizerClass::tokenize_text( const string& text,
+				      vector<vector<Token>>& sentences ){
+    // tokenize text on its own, to its sentences
+    reset();
+    reader->open( text.data(), text.size(), inputEncoding );
+    size_t count = 0;
+    while ( true ){
+      if ( count == sentences.size() ){
+	sentences.push_back( vector<Token>() );
+      }
+      if ( !next_sentence( sentences[count] ) ){
+	break;
+      }
+      ++count;
+    }
+    sentences.resize( count );
+  }
+
+  void TokenizerClass::copy_options( const TokenizerClass& from ){
+    // take over all options of from. Our model stays the same
+    tokDebug = from.tokDebug;
+    verbose = from.verbose;
+    detectQuotes = from.detectQuotes;
+    quote_lookback = from.quote_lookback;
+    doFilter = from.doFilter;
+    doPunctFilter = from.doPunctFilter;
+    doWordCorrection = from.doWordCorrection;
+    splitOnly = from.splitOnly;
+    detectPar = from.detectPar;
+    doDetectLang = from.doDetectLang;
+    tc_debug = from.tc_debug;
+    text_redundancy = from.text_redundancy;
+    sentenceperlineoutput = from.sentenceperlineoutput;
+    sentenceperlineinput = from.sentenceperlineinput;
+    lowercase = from.lowercase;
+    uppercase = from.uppercase;
+    xmlout = from.xmlout;
+    xmlin = from.xmlin;
+    passthru = from.passthru;
+    span_matching = from.span_matching;
+    letter_path = from.letter_path;
+    ignore_tag_hints = from.ignore_tag_hints;
+    default_language = from.default_language;
+    text_language = from.text_language;
+    eosmark = from.eosmark;
+    norm_set = from.norm_set;
+    normalizer.setMode( from.normalizer.getMode() );
+    inputEncoding = from.inputEncoding;
+    utf8_input = from.utf8_input;
+    inputclass = from.inputclass;
+    outputclass = from.outputclass;
+    docid = from.docid;
+    _command = from._command;
+    word_cache.clear();
+    word_cache.resize( from.word_cache.capacity() );
+  }
+
+  void TokenizerClass::tokenizeBatch( const vector<string>& texts,
+				      vector<vector<vector<Token>>>& result,
+				      size_t threads,
+				      const BatchOptions& options ){
+    result.resize( texts.size() );
+    if ( !options && ( threads < 2 || texts.size() < 2 ) ){
+      for ( size_t i=0; i < texts.size(); ++i ){
+	tokenize_text( texts[i], result[i] );
+      }
+      return;
+    }
+    // sessions on our model, with our options and those for this batch
+    threads = max( size_t(1), min( threads, texts.size() ) );
+    vector<TokenizerClass*> sessions;
+    try {
+      for ( size_t i=0; i < threads; ++i ){
+	TokenizerClass *session = model ? new TokenizerSession( *model )
+	  : new TokenizerClass();
+	sessions.push_back( session );
+	session->copy_options( *this );
+	if ( options ){
+	  options( *session );
+	}
+      }
+    }
+    catch ( ... ){
+      for ( const auto& session : sessions ){
+	delete session;
+      }
+      throw;
+    }
+    // every session takes the next text, until none are left
+    atomic<size_t> next( 0 );
+    exception_ptr error;
+    mutex error_mutex;
+    auto work = [&]( TokenizerClass *session ){
+      try {
+	for ( size_t i = next++; i < texts.size(); i = next++ ){
+	  session->tokenize_text( texts[i], result[i] );
+	}
+      }
+      catch ( ... ){
+	// keep the first error, and let the others finish
+	lock_guard<mutex> lock( error_mutex );
+	if ( !error ){
+	  error = current_exception();
+	}
+	next = texts.size();
+      }
+    };
+    vector<thread> workers;
+    for ( size_t i=1; i < sessions.size(); ++i ){
+      workers.push_back( thread( work, sessions[i] ) );
+    }
+    work( sessions[0] );
+    for ( auto& t : workers ){
+      t.join();
+    }
+    for ( const auto& session : sessions ){
+      delete session;
+    }
+    if ( error ){
+      rethrow_exception( error );
+    }
+  }
+
+  vector<vector<vector<Token>>>
+  TokenizerClass::tokenizeBatch( const vector<string>& texts,
+				 size_t threads,
+				 const BatchOptions& options ){
+    vector<vector<vector<Token>>> result;
+    tokenizeBatch( texts, result, threads, options );
+    return result;
   }
 
   void TokenizerClass::tokenize( istream& IN, ostream& OUT) {
@@ -716,23 +1479,8 @@ namespace Tokenizer {
     }
 #endif
     else {
-      int i = 0;
-      inputEncoding = checkBOM( IN );
-      do {
-	if ( tokDebug > 0 ){
-	  LOG << "[tokenize] looping on stream" << endl;
-	}
-	vector<Token> v = tokenizeOneSentence( IN );
-	while( !v.empty() ){
-	  outputTokens( OUT, v , (i>0) );
-	  ++i;
-	  v = tokenizeOneSentence( IN );
-	}
-      } while ( IN );
-      if ( tokDebug > 0 ){
-	LOG << "[tokenize] end_of_stream" << endl;
-      }
-      OUT << endl;
+      attach( IN );
+      sentences_to_stream( OUT );
     }
   }
 
@@ -1519,7 +2267,14 @@ namespace Tokenizer {
     }
   }
 
-  void TokenizerClass::outputTokens( ostream& OUT,
+  void TokenizerClass::outputTokens( ostream& OUT,
+				     const vector<Token>& tokens,
+				     const bool continued ) const {
+    Utf8Writer out( OUT );
+    outputTokens( out, tokens, continued );
+  }
+
+  void TokenizerClass::outputTokens( Utf8Writer& out,
 				     const vector<Token>& tokens,
 				     const bool continued ) const {
     // continued should be set to true when outputTokens is invoked multiple
@@ -1536,10 +2291,10 @@ namespace Tokenizer {
 	   && continued ) {
 	//output paragraph separator
 	if (sentenceperlineoutput) {
-	  OUT << endl;
+	  out.put( '\n' );
 	}
 	else {
-	  OUT << endl << endl;
+	  out.put( "\n\n" );
 	}
       }
       UnicodeString s = token.us;
@@ -1549,7 +2304,7 @@ namespace Tokenizer {
       else if (uppercase) {
 	s = s.toUpper();
       }
-      OUT << s;
+      out.put( s );
       if ( token.role & NEWPARAGRAPH) {
 	quotelevel = 0;
       }
@@ -1557,7 +2312,11 @@ namespace Tokenizer {
 	++quotelevel;
       }
       if (verbose) {
-	OUT << "\t" << token.type << "\t" << token.role << endl;
+	out.put( '\t' );
+	out.put( token.type );
+	out.put( '\t' );
+	out.put( role_string( token.role ) );
+	out.put( '\n' );
       }
       if ( token.role & ENDQUOTE) {
 	--quotelevel;
@@ -1566,25 +2325,27 @@ namespace Tokenizer {
       if ( token.role & ENDOFSENTENCE) {
 	if ( verbose ) {
 	  if ( !(token.role & NOSPACE ) ){
-	    OUT << endl;
+	    out.put( '\n' );
 	  }
 	}
 	else {
 	  if ( quotelevel == 0 ) {
 	    if (sentenceperlineoutput) {
-	      OUT << endl;
+	      out.put( '\n' );
 	    }
 	    else {
-	      OUT << " " + eosmark + " ";
+	      out.put( ' ' );
+	      out.put( eosmark );
+	      out.put( ' ' );
 	    }
 	    if ( splitOnly ){
-	      OUT << endl;
+	      out.put( '\n' );
 	    }
 	  }
 	  else { //inside quotation
 	    if ( splitOnly
 		 && !(token.role & NOSPACE ) ){
-	      OUT << " ";
+	      out.put( ' ' );
 	    }
 	  }
 	}
@@ -1599,19 +2360,47 @@ namespace Tokenizer {
 		 && (token.role & NOSPACE) ){
 	    }
 	    else {
-	      OUT << " ";
+	      out.put( ' ' );
 	    }
 	  }
 	}
 	else if ( (quotelevel > 0)
 		  && sentenceperlineoutput ) {
 	  //FBK: ADD SPACE WITHIN QUOTE CONTEXT IN ANY CASE
-	  OUT << " ";
+	  out.put( ' ' );
 	}
       }
     }
   }
 
+  inline bool is_mark( const Token& token ){
+    // is token one of TokenizerClass::quote_marks?
+    return token.role & ( BEGINQUOTE | ENDQUOTE | NEWPARAGRAPH );
+  }
+
+  void TokenizerClass::SentenceScan::rewind( size_t pos ){
+    // the role of token pos changed. Go back to the last saved state that
+    // doesn't depend on it
+    if ( next <= pos ){
+      return;
+    }
+    while ( saved.size() > 1 && saved.back().next > pos ){
+      saved.pop_back();
+    }
+    *static_cast<ScanState*>(this) = saved.back();
+    while ( !ends.empty() && ends.back() >= next ){
+      ends.pop_back();
+    }
+  }
+
+  void TokenizerClass::SentenceScan::forget( size_t pos ){
+    // the sentences before pos are popped. pos starts a new one
+    while ( !saved.empty() && saved.front().next <= pos ){
+      saved.pop_front();
+    }
+    saved.push_front( ScanState( pos, temp_eos ) );
+  }
+
   int TokenizerClass::countSentences( bool forceentirebuffer ) {
     //Return the number of *completed* sentences in the token buffer
 
@@ -1619,12 +2408,40 @@ namespace Tokenizer {
     //BEGINOFSENTENCE and ENDOFSENTENCE always pair up, and that TEMPENDOFSENTENCE roles
     //are converted to proper ENDOFSENTENCE markers
 
-    short quotelevel = 0;
-    int count = 0;
-    const int size = tokens.size();
-    int begin = 0;
-    int i = 0;
-    for ( auto& token : tokens ) {
+    // We don't rescan the whole buffer on every call, but resume at the
+    // position saved in 'scan' by the previous call.
+    const size_t size = tokens.size();
+    if ( scan.next < tokens_offset
+	 || scan.next > tokens_offset + size
+	 || ( forceentirebuffer && scan.temp_eos ) ){
+      // start all over
+      scan.reset( tokens_offset );
+    }
+    // Tokenizing the next line only modifies the last token, so we save our
+    // state there, and every 64 tokens before it. resolveQuote() and
+    // abandonQuotes() take 'scan' back when they modify earlier tokens
+    const size_t last = ( size > 0 ) ? size - 1 : 0;
+    short quotelevel = scan.quotelevel;
+    size_t begin = scan.begin - tokens_offset;
+    bool temp_eos = scan.temp_eos;
+    size_t keep = scan.ends.size();
+    size_t i = scan.next - tokens_offset;
+    while ( i < size ) {
+      Token& token = tokens[i];
+      if ( i == last
+	   || tokens_offset + i >= scan.saved.back().next + 64 ){
+	// save the state before this token
+	ScanState state( tokens_offset + i, temp_eos );
+	state.quotelevel = quotelevel;
+	state.begin = tokens_offset + begin;
+	if ( i == last ){
+	  static_cast<ScanState&>( scan ) = state;
+	  keep = scan.ends.size();
+	}
+	else {
+	  scan.saved.push_back( state );
+	}
+      }
       if (tokDebug >= 5){
 	LOG << "[countSentences] buffer#" <<i
 			<< " word=[" << token.us
@@ -1634,35 +2451,51 @@ namespace Tokenizer {
       if (token.role & NEWPARAGRAPH) quotelevel = 0;
       if (token.role & BEGINQUOTE) quotelevel++;
       if (token.role & ENDQUOTE) quotelevel--;
-      if ( forceentirebuffer
-	   && (token.role & TEMPENDOFSENTENCE)
+      if ( (token.role & TEMPENDOFSENTENCE)
 	   && (quotelevel == 0)) {
-	//we thought we were in a quote, but we're not... No end quote was found and an end is forced now.
-	//Change TEMPENDOFSENTENCE to ENDOFSENTENCE and make sure sentences match up sanely
-	token.role &= ~TEMPENDOFSENTENCE;
-	token.role |= ENDOFSENTENCE;
+	if ( forceentirebuffer ){
+	  //we thought we were in a quote, but we're not... No end quote was found and an end is forced now.
+	  //Change TEMPENDOFSENTENCE to ENDOFSENTENCE and make sure sentences match up sanely
+	  token.role &= ~TEMPENDOFSENTENCE;
+	  token.role |= ENDOFSENTENCE;
+	}
+	else {
+	  // a forced call has to look at this one again
+	  temp_eos = true;
+	}
       }
       tokens[begin].role |= BEGINOFSENTENCE;  //sanity check
       if ( (token.role & ENDOFSENTENCE)
 	   && (quotelevel == 0) ) {
 	begin = i + 1;
-	count++;
+	scan.ends.push_back( tokens_offset + i );
 	if (tokDebug >= 5){
-	  LOG << "[countSentences] SENTENCE #" << count << " found" << endl;
+	  LOG << "[countSentences] SENTENCE #" << scan.ends.size()
+	      << " found" << endl;
 	}
       }
       if ( forceentirebuffer
 	   && ( i == size - 1)
 	   && !(token.role & ENDOFSENTENCE) )  {
 	//last token of buffer
-	count++;
+	scan.ends.push_back( tokens_offset + i );
 	token.role |= ENDOFSENTENCE;
 	if (tokDebug >= 5){
-	  LOG << "[countSentences] SENTENCE #" << count << " *FORCIBLY* ended" << endl;
+	  LOG << "[countSentences] SENTENCE #" << scan.ends.size()
+	      << " *FORCIBLY* ended" << endl;
 	}
       }
       ++i;
+      if ( quotelevel != 0 && i < last && !is_mark( tokens[i] ) ){
+	// inside a quote, only the quote marks, a new paragraph and the
+	// last token matter
+	auto it = quote_marks.upper_bound( tokens_offset + i );
+	i = ( it == quote_marks.end() ) ? last : min( *it - tokens_offset, last );
+      }
     }
+    int count = scan.ends.size();
+    // forget the sentences found after the saved position
+    scan.ends.resize( keep );
     if (tokDebug >= 5){
       LOG << "[countSentences] end of loop: returns " << count << endl;
     }
@@ -1671,6 +2504,14 @@ namespace Tokenizer {
 
   vector<Token> TokenizerClass::popSentence( ) {
     vector<Token> outToks;
+    pop_sentence( outToks );
+    return outToks;
+  }
+
+  bool TokenizerClass::pop_sentence( vector<Token>& outToks ){
+    // move the first sentence of the buffer to outToks, reusing its storage.
+    // false when there is none
+    outToks.clear();
     const int size = tokens.size();
     if ( size != 0 ){
       short quotelevel = 0;
@@ -1697,22 +2538,39 @@ namespace Tokenizer {
 	    LOG << "[tokenize] extracted sentence, begin=" << begin
 		<< ",end="<< end << endl;
 	  }
-	  for ( size_t index=begin; index <= end; ++index ){
-	    outToks.push_back( tokens[index] );
-	  }
+	  outToks.assign( make_move_iterator( tokens.begin()+begin ),
+			  make_move_iterator( tokens.begin()+end+1 ) );
+	  // a deque, so this doesn't move the remaining tokens
 	  tokens.erase( tokens.begin(), tokens.begin()+end+1 );
+	  tokens_offset += end+1;
+	  if ( !scan.ends.empty()
+	       && scan.ends.front() + 1 == tokens_offset ){
+	    // the first sentence countSentences() found. It may resume
+	    scan.ends.pop_front();
+	    scan.forget( tokens_offset );
+	  }
+	  else {
+	    scan.reset( tokens_offset );
+	  }
+	  quote_marks.erase( quote_marks.begin(),
+			     quote_marks.lower_bound( tokens_offset ) );
 	  if ( !passthru ){
-	    string lang = get_language( outToks );
-	    if ( !settings[lang]->quotes.emptyStack() ) {
-	      settings[lang]->quotes.flushStack( end+1 );
+	    // the tokens before tokens_offset are gone, for every language.
+	    // So forget the quotes that opened there, in the stacks of all
+	    // languages
+	    for ( const auto& it : settings ){
+	      QuoteStack& quotes = it.second->quotes;
+	      if ( !quotes.empty() ) {
+		quotes.flushStack( tokens_offset );
+	      }
 	    }
 	  }
 	  // we are done...
-	  return outToks;
+	  return true;
 	}
       }
     }
-    return outToks;
+    return false;
   }
 
   string TokenizerClass::getString( const vector<Token>& v ){
@@ -1746,57 +2604,34 @@ namespace Tokenizer {
   }
 
   // FBK: return true if character is a quote.
-  bool TokenizerClass::u_isquote( UChar32 c, const Quoting& quotes ) const {
-    bool quote = false;
-    if ( u_hasBinaryProperty( c, UCHAR_QUOTATION_MARK )
-	 || c == '`'
-	 || c == U'´' ) {
-      // M$ users use the spacing grave and acute accents often as a
-      // quote (apostroph) but is DOESN`T have the UCHAR_QUOTATION_MARK property
-      // so trick that
-      quote = true;
-    }
-    else {
-      UnicodeString opening = quotes.lookupOpen( c );
-      if (!opening.isEmpty()) {
-	quote = true;
-      }
-      else {
-	UnicodeString closing = quotes.lookupClose( c );
-	if (!closing.isEmpty()) {
-	  quote = true;
-	}
-      }
-    }
-    return quote;
+  bool TokenizerClass::u_isquote( UChar32 c, const Setting& set ) const {
+    return set.chars.is( c, CharTable::QUOTE );
   }
 
   //FBK: USED TO CHECK IF CHARACTER AFTER QUOTE IS AN BOS.
   //MOSTLY THE SAME AS ABOVE, EXCEPT WITHOUT CHECK FOR PUNCTUATION
   //BECAUSE: '"Hoera!", zei de man' MUST NOT BE SPLIT ON ','..
-  bool is_BOS( UChar32 c ){
-    bool is_bos = false;
-    UBlockCode s = ublock_getCode(c);
+  bool is_BOS( UChar32 c, const CharTable& chars ){
     //test for languages that distinguish case
-    if ( (s == UBLOCK_BASIC_LATIN) || (s == UBLOCK_GREEK)
-	 || (s == UBLOCK_CYRILLIC) || (s == UBLOCK_GEORGIAN)
-	 || (s == UBLOCK_ARMENIAN) || (s == UBLOCK_DESERET)) {
-      if ( u_isupper(c) || u_istitle(c) ) {
-	//next 'word' starts with more punctuation or with uppercase
-	is_bos = true;
-      }
-    }
-    return is_bos;
+    //next 'word' starts with more punctuation or with uppercase
+    const uint16_t bos = CharTable::CASED_BLOCK | CharTable::UPPER;
+    return ( chars.flags( c ) & bos ) == bos;
   }
 
   bool TokenizerClass::resolveQuote( int endindex,
 				     const UnicodeString& open,
-				     Quoting& quotes ) {
+				     SettingState& state ) {
     //resolve a quote
+    const Setting& set = *state.setting;
+    QuoteStack& quotes = state.quotes;
     int stackindex = -1;
-    int beginindex = quotes.lookup( open, stackindex );
-
-    if (beginindex >= 0) {
+    size_t quote_index = 0;
+    if ( !quotes.empty() && quotes.oldestOpen() < tokens_offset ){
+      // a quote of a sentence that is already popped. Can't resolve it
+      quotes.flushStack( tokens_offset );
+    }
+    if ( quotes.lookup( open, stackindex, quote_index ) ) {
+      int beginindex = quote_index - tokens_offset;
       if (tokDebug >= 2) {
 	LOG << "[resolveQuote] Quote found, begin="<< beginindex << ", end="<< endindex << endl;
       }
@@ -1806,13 +2641,16 @@ namespace Tokenizer {
       }
 
       //We have a quote!
+      // countSentences() has to look at the tokens from here on again
+      scan.rewind( quote_index );
 
       //resolve sentences within quote, all sentences must be full sentences:
       int beginsentence = beginindex + 1;
       int expectingend = 0;
       int subquote = 0;
       int size = tokens.size();
-      for (int i = beginsentence; i < endindex; i++) {
+      int i = beginsentence;
+      while ( i < endindex ) {
 	if (tokens[i].role & BEGINQUOTE) subquote++;
 
 	if (subquote == 0) {
@@ -1836,11 +2674,21 @@ namespace Tokenizer {
 	  beginsentence = i + 1;
 	}
 	if (tokens[i].role & ENDQUOTE) subquote--;
+	++i;
+	if ( subquote != 0 && i < endindex && !is_mark( tokens[i] ) ){
+	  // in a subquote, that is resolved already. Only its quote marks
+	  // matter, so we don't look at its tokens again
+	  auto it = quote_marks.upper_bound( tokens_offset + i );
+	  i = ( it == quote_marks.end() ) ? endindex
+	    : min( int( *it - tokens_offset ), endindex );
+	}
       }
       if ((expectingend == 0) && (subquote == 0)) {
 	//ok, all good, mark the quote:
 	tokens[beginindex].role |= BEGINQUOTE;
 	tokens[endindex].role |= ENDQUOTE;
+	quote_marks.insert( quote_index );
+	quote_marks.insert( tokens_offset + endindex );
 	if ( tokDebug >= 2 ) {
 	  LOG << "marked BEGIN: " << tokens[beginindex] << endl;
 	  LOG << "marked   END: " << tokens[endindex] << endl;
@@ -1857,6 +2705,8 @@ namespace Tokenizer {
 	//mark the quote
 	tokens[beginindex].role |= BEGINQUOTE;
 	tokens[endindex].role |= ENDQUOTE;
+	quote_marks.insert( quote_index );
+	quote_marks.insert( tokens_offset + endindex );
       }
       else {
 	if ( tokDebug >= 2) {
@@ -1872,19 +2722,19 @@ namespace Tokenizer {
 	   && tokens[endindex-1].role & ENDOFSENTENCE ) {
         //FBK: CHECK FOR EOS AFTER QUOTES
         if ((endindex+1 == size) || //FBK: endindex EQUALS TOKEN SIZE, MUST BE EOSMARKERS
-            ((endindex + 1 < size) && (is_BOS(tokens[endindex+1].us[0])))) {
+            ((endindex + 1 < size) && (is_BOS(tokens[endindex+1].us[0], set.chars)))) {
 	  tokens[endindex].role |= ENDOFSENTENCE;
 	  // FBK: CHECK IF NEXT TOKEN IS A QUOTE AND NEXT TO THE QUOTE A BOS
         }
 	else if ( endindex + 2 < size
-		  && u_isquote( tokens[endindex+1].us[0], quotes )
-		  && is_BOS( tokens[endindex+2].us[0] ) ) {
+		  && u_isquote( tokens[endindex+1].us[0], set )
+		  && is_BOS( tokens[endindex+2].us[0], set.chars ) ) {
 	  tokens[endindex].role |= ENDOFSENTENCE;
 	  // If the current token is an ENDQUOTE and the next token is a quote and also the last token,
 	  // the current token is an EOS.
         }
 	else if ( endindex + 2 == size
-		  && u_isquote( tokens[endindex+1].us[0], quotes ) ) {
+		  && u_isquote( tokens[endindex+1].us[0], set ) ) {
 	  tokens[endindex].role |= ENDOFSENTENCE;
         }
       }
@@ -1896,24 +2746,23 @@ namespace Tokenizer {
   }
 
   bool TokenizerClass::detectEos( size_t i,
-				  const UnicodeString& eosmarkers,
-				  const Quoting& quotes ) const {
+				  const Setting& set ) const {
     bool is_eos = false;
     UChar32 c = tokens[i].us.char32At(0);
-    if ( c == '.' || eosmarkers.indexOf( c ) >= 0 ){
+    if ( c == '.' || set.eosmarkers.indexOf( c ) >= 0 ){
       if (i + 1 == tokens.size() ) {	//No next character?
 	is_eos = true; //Newline after eosmarker
       }
       else {
 	c = tokens[i+1].us.char32At(0);
-	if ( u_isquote( c, quotes ) ){
+	if ( u_isquote( c, set ) ){
 	  // next word is quote
 	  if ( detectQuotes ){
 	    is_eos = true;
 	  }
 	  else if ( i + 2 < tokens.size() ) {
 	    c = tokens[i+2].us.char32At(0);
-	    if ( u_isupper(c) || u_istitle(c) || u_ispunct(c) ){
+	    if ( set.chars.is( c, CharTable::UPPER | CharTable::PUNCT ) ){
 	      //next 'word' after quote starts with uppercase or is punct
 	      is_eos = true;
 	    }
@@ -1921,7 +2770,7 @@ namespace Tokenizer {
 	}
 	else if ( tokens[i].us.length() > 1 ){
 	  // PUNCTUATION multi...
-	  if ( u_isupper(c) || u_istitle(c) )
+	  if ( set.chars.is( c, CharTable::UPPER ) )
 	    is_eos = true;
 	}
 	else
@@ -1932,46 +2781,47 @@ namespace Tokenizer {
   }
 
   void TokenizerClass::detectQuoteBounds( const int i,
-					  Quoting& quotes ) {
+					  SettingState& state ) {
+    QuoteStack& stack = state.quotes;
+    const Quoting& quotes = state.setting->quotes;
     UChar32 c = tokens[i].us.char32At(0);
     //Detect Quotation marks
     if ((c == '"') || ( UnicodeString(c) == "＂") ) {
       if (tokDebug > 1 ){
 	LOG << "[detectQuoteBounds] Standard double-quote (ambiguous) found @i="<< i << endl;
       }
-      if (!resolveQuote(i,c,quotes)) {
+      if (!resolveQuote(i,c,state)) {
 	if (tokDebug > 1 ) {
 	  LOG << "[detectQuoteBounds] Doesn't resolve, so assuming beginquote, pushing to stack for resolution later" << endl;
 	}
-	quotes.push( i, c );
+	stack.push( tokens_offset + i, c );
       }
     }
     else if ( c == '\'' ) {
       if (tokDebug > 1 ){
 	LOG << "[detectQuoteBounds] Standard single-quote (ambiguous) found @i="<< i << endl;
       }
-      if (!resolveQuote(i,c,quotes)) {
+      if (!resolveQuote(i,c,state)) {
 	if (tokDebug > 1 ) {
 	  LOG << "[detectQuoteBounds] Doesn't resolve, so assuming beginquote, pushing to stack for resolution later" << endl;
 	}
-	quotes.push( i, c );
+	stack.push( tokens_offset + i, c );
       }
     }
     else {
-      UnicodeString close = quotes.lookupOpen( c );
-      if ( !close.isEmpty() ){ // we have a opening quote
+      if ( quotes.openPair( c ) >= 0 ){ // we have a opening quote
 	if ( tokDebug > 1 ) {
 	  LOG << "[detectQuoteBounds] Opening quote found @i="<< i << ", pushing to stack for resolution later..." << endl;
 	}
-	quotes.push( i, c ); // remember it
+	stack.push( tokens_offset + i, c ); // remember it
       }
       else {
-	UnicodeString open = quotes.lookupClose( c );
-	if ( !open.isEmpty() ) { // we have a closing quote
+	int pair = quotes.closePair( c );
+	if ( pair >= 0 ) { // we have a closing quote
 	  if (tokDebug > 1 ) {
 	    LOG << "[detectQuoteBounds] Closing quote found @i="<< i << ", attempting to resolve..." << endl;
 	  }
-	  if ( !resolveQuote( i, open, quotes )) {
+	  if ( !resolveQuote( i, quotes.openQuote( pair ), state )) {
 	    // resolve the matching opening
 	    if (tokDebug > 1 ) {
 	      LOG << "[detectQuoteBounds] Unable to resolve" << endl;
@@ -1982,6 +2832,46 @@ namespace Tokenizer {
     }
   }
 
+  void TokenizerClass::abandonQuotes( const int i,
+				     SettingState& state ) {
+    // forget the opening quotes more than quote_lookback tokens before
+    // token i. They will never be resolved now, so the sentences after them
+    // are ended, as a forced countSentences() would do at the end of the
+    // paragraph. So the sentences after a dangling quote are output
+    // before the end of the paragraph.
+    QuoteStack& quotes = state.quotes;
+    const size_t pos = tokens_offset + i;
+    if ( quote_lookback == 0
+	 || quotes.empty()
+	 || quotes.oldestOpen() + quote_lookback >= pos ){
+      return;
+    }
+    size_t begin = quotes.oldestOpen();
+    begin = ( begin > tokens_offset ) ? begin - tokens_offset : 0;
+    quotes.flushStack( pos - quote_lookback );
+    // the tokens up to the oldest quote still open are outside quotes now
+    size_t end = i;
+    if ( !quotes.empty() ){
+      end = quotes.oldestOpen() - tokens_offset;
+    }
+    if ( tokDebug > 1 ){
+      LOG << "[abandonQuotes] giving up on quotes before @i="
+	  << i - quote_lookback << ", ending sentences in " << begin
+	  << "-" << end << endl;
+    }
+    scan.rewind( tokens_offset + begin );
+    short quotelevel = 0;
+    for ( size_t j = begin; j < end; ++j ){
+      if ( tokens[j].role & BEGINQUOTE ) ++quotelevel;
+      if ( tokens[j].role & ENDQUOTE ) --quotelevel;
+      if ( ( tokens[j].role & TEMPENDOFSENTENCE )
+	   && quotelevel == 0 ){
+	tokens[j].role &= ~TEMPENDOFSENTENCE;
+	tokens[j].role |= ENDOFSENTENCE;
+      }
+    }
+  }
+
   bool isClosing( const Token& tok ){
     if ( tok.us.length() == 1 &&
 	 ( tok.us[0] == ')' || tok.us[0] == '}'
@@ -2007,18 +2897,22 @@ namespace Tokenizer {
 	    << "] type=" << tokens[i].type
 	    << ", role=" << tokens[i].role << endl;
       }
+      if ( tokens[i].role & NEWPARAGRAPH ){
+	quote_marks.insert( tokens_offset + i );
+      }
+      if ( detectQuotes ){
+	abandonQuotes( i, *settings[lang] );
+      }
       if ( tokens[i].type.startsWith("PUNCTUATION") ){
 	if ((tokDebug > 1 )){
 	  LOG << method << " PUNCTUATION FOUND @i=" << i << endl;
 	}
 	// we have some kind of punctuation. Does it mark an eos?
-	bool is_eos = detectEos( i,
-				 settings[lang]->eosmarkers,
-				 settings[lang]->quotes );
+	bool is_eos = detectEos( i, *settings[lang]->setting );
 	if (is_eos) {
 	  // end of sentence found/ so wrap up
 	  if ( detectQuotes
-	       && !settings[lang]->quotes.emptyStack() ) {
+	       && !settings[lang]->quotes.empty() ) {
 	    // we have some quotes!
 	    if ( tokDebug > 1 ){
 	      LOG << method << " Unbalances quotes: Preliminary EOS FOUND @i="
@@ -2069,7 +2963,7 @@ namespace Tokenizer {
 	}
 	if ( detectQuotes ){
 	  // check the quotes
-	  detectQuoteBounds( i, settings[lang]->quotes );
+	  detectQuoteBounds( i, *settings[lang] );
 	}
       }
     }
@@ -2236,36 +3130,10 @@ namespace Tokenizer {
     }
   }
 
-  string TokenizerClass::checkBOM( istream& in ){
-    string result = inputEncoding;
-    if ( &in == &cin ){
-      return result;
-    }
-    streampos pos = in.tellg();
-    string s;
-    in >> s;
-    UErrorCode err = U_ZERO_ERROR;
-    int32_t bomLength = 0;
-    const char *encoding = ucnv_detectUnicodeSignature( s.c_str(), s.length(),
-							&bomLength, &err);
-    if ( bomLength ){
-      if ( tokDebug ){
-	LOG << "Autodetected encoding: " << encoding << endl;
-      }
-      result = encoding;
-      if ( result == "UTF16BE"
-	   || result == "UTF-16BE" ){
-	result = "UTF16BE";
-      }
-    }
-    in.seekg( pos + (streampos)bomLength );
-    return result;
-  }
-
   // string wrapper
   void TokenizerClass::tokenizeLine( const string& s,
 				     const string& lang ){
-    UnicodeString us = convert( s, inputEncoding );
+    UnicodeString us = convert( s, inputEncoding, utf8_input );
     tokenizeLine( us, lang );
   }
 
@@ -2280,50 +3148,30 @@ namespace Tokenizer {
     countSentences(true); // force the ENDOFSENTENCE
   }
 
-  bool u_isemo( UChar32 c ){
-    UBlockCode s = ublock_getCode(c);
-    return s == UBLOCK_EMOTICONS;
-  }
-
-  bool u_ispicto( UChar32 c ){
-    UBlockCode s = ublock_getCode(c);
-    return s == UBLOCK_MISCELLANEOUS_SYMBOLS_AND_PICTOGRAPHS ;
-  }
-
-  bool u_iscurrency( UChar32 c ){
-    return u_charType( c ) == U_CURRENCY_SYMBOL;
-  }
-
-  bool u_issymbol( UChar32 c ){
-    return u_charType( c ) == U_CURRENCY_SYMBOL
-      || u_charType( c ) == U_MATH_SYMBOL
-      || u_charType( c ) == U_MODIFIER_SYMBOL
-      || u_charType( c ) == U_OTHER_SYMBOL;
-  }
-
-  const UnicodeString& detect_type( UChar32 c ){
-    if ( u_isspace(c)) {
+  const UnicodeString& detect_type( UChar32 c, const CharTable& chars ){
+    uint16_t flags = chars.flags( c );
+    if ( flags & CharTable::SPACE ) {
       return type_space;
     }
-    else if ( u_iscurrency(c)) {
+    else if ( flags & CharTable::CURRENCY ) {
       return type_currency;
     }
-    else if ( u_ispunct(c)) {
+    else if ( flags & CharTable::PUNCT ) {
       return type_punctuation;
     }
-    else if ( u_isemo( c ) ) {
+    else if ( flags & CharTable::EMOTICON ) {
       return type_emoticon;
     }
-    else if ( u_ispicto( c ) ) {
+    else if ( flags & CharTable::PICTO ) {
       return type_picto;
     }
-    else if ( u_isalpha(c)) {
+    else if ( flags & CharTable::ALPHA ) {
       return type_word;
     }
-    else if ( u_isdigit(c)) {
+    else if ( flags & CharTable::DIGIT ) {
       return type_number;
     }
-    else if ( u_issymbol(c)) {
+    else if ( flags & CharTable::SYMBOL ) {
       return type_symbol;
     }
     else {
@@ -2426,10 +3274,9 @@ namespace Tokenizer {
 	  << "   '" << input << "'" << endl;
       return 0;
     }
-    int32_t len = input.countChar32();
     if (tokDebug){
       LOG << "[tokenizeLine] filtered input: line=["
-		      << input << "] (" << len
+		      << input << "] (" << input.countChar32()
 		      << " unicode characters)" << endl;
     }
     const int begintokencount = tokens.size();
@@ -2439,13 +3286,27 @@ namespace Tokenizer {
 
     bool tokenizeword = false;
     bool reset = false;
-    //iterate over all characters
+    // the characters that mean a word has to go through the rules
+    const uint16_t special = CharTable::PUNCT | CharTable::DIGIT
+      | CharTable::QUOTE | CharTable::EMOTICON;
+    const CharTable& chars = settings[lang]->setting->chars;
+    //iterate over all characters, directly on the UTF-16 buffer.
+    // A word is the span [word_start,word_end) of input. It is only copied
+    // out when it is complete.
+    const UChar *buf = input.getBuffer();
+    const int32_t buf_len = input.length();
+    int32_t pos = 0;
+    int32_t word_start = 0;
+    int32_t word_end = 0;
     UnicodeString word;
-    StringCharacterIterator sit(input);
-    long int i = 0;
     long int tok_size = 0;
-    while ( sit.hasNext() ){
-      UChar32 c = sit.current32();
+    while ( pos < buf_len ){
+      UChar32 c;
+      int32_t next = pos;
+      U16_NEXT( buf, next, buf_len, c );
+      const bool last = ( next == buf_len );
+      const uint16_t flags = chars.flags( c );
+      const bool space = ( flags & CharTable::SPACE ) != 0;
       bool joiner = false;
       if ( c == u'\u200D' ){
 	joiner = true;
@@ -2459,34 +3320,34 @@ namespace Tokenizer {
       if (reset) { //reset values for new word
 	reset = false;
 	tok_size = 0;
-	if ( !joiner && !u_isspace(c) ){
-	  word = c;
+	if ( !joiner && !space ){
+	  word_start = pos;
+	  word_end = next;
 	}
 	else {
-	  word = "";
+	  word_start = word_end = next;
 	}
 	tokenizeword = false;
       }
-      else if ( !joiner && !u_isspace(c) ){
-	word += c;
+      else if ( !joiner && !space ){
+	word_end = next;
       }
-      if ( joiner && sit.hasNext() ){
-	UChar32 peek = sit.next32();
-	if ( u_isspace(peek) ){
+      if ( joiner && !last ){
+	UChar32 peek;
+	int32_t peek_pos = next;
+	U16_NEXT( buf, peek_pos, buf_len, peek );
+	if ( chars.is( peek, CharTable::SPACE ) ){
 	  joiner = false;
 	}
-	sit.previous32();
       }
-      if ( u_isspace(c) || joiner || i == len-1 ){
+      if ( space || joiner || last ){
+	word.setTo( input, word_start, word_end - word_start );
 	if (tokDebug){
 	  LOG << "[tokenizeLine] space detected, word=[" << word << "]" << endl;
 	}
-	if ( i == len-1 ) {
+	if ( last ) {
 	  if ( joiner
-	       || u_ispunct(c)
-	       || u_isdigit(c)
-	       || u_isquote( c, settings[lang]->quotes )
-	       || u_isemo(c) ){
+	       || ( flags & special ) ){
 	    tokenizeword = true;
 	  }
 	}
@@ -2551,24 +3412,23 @@ namespace Tokenizer {
 	//reset values for new word
 	reset = true;
       }
-      else if ( u_ispunct(c)
-		|| u_isdigit(c)
-		|| u_isquote( c, settings[lang]->quotes )
-		|| u_isemo(c) ){
+      else if ( flags & special ){
 	if (tokDebug){
 	  LOG << "[tokenizeLine] punctuation or digit detected, word=["
-			  << word << "]" << endl;
+	      << UnicodeString( input, word_start, word_end - word_start )
+	      << "]" << endl;
 	}
 	//there is punctuation or digits in this word, mark to run through tokenizer
 	tokenizeword = true;
       }
-      sit.next32();
-      ++i;
+      pos = next;
       ++tok_size;
       if ( tok_size > 2500 ){
 	LOG << "Ridiculously long word/token (over 2500 characters) detected "
 	    << "in line: " << linenum << ". Skipped ..." << endl;
-	LOG << "The line starts with " << UnicodeString( word, 0, 75 )
+	LOG << "The line starts with "
+	    << UnicodeString( input, word_start,
+			      min( 75, word_end - word_start ) )
 	    << "..." << endl;
 	return 0;
       }
@@ -2595,10 +3455,239 @@ namespace Tokenizer {
     return numNewTokens;
   }
 
+  const WordCache::Result *WordCache::lookup( const Key& key ){
+    auto it = index.find( key );
+    if ( it == index.end() ){
+      ++misses;
+      return 0;
+    }
+    ++hits;
+    entries.splice( entries.begin(), entries, it->second );
+    return &it->second->second;
+  }
+
+  void WordCache::store( const Key& key, const Result& result ){
+    if ( max_size == 0 || index.find( key ) != index.end() ){
+      return;
+    }
+    if ( entries.size() >= max_size ){
+      index.erase( entries.back().first );
+      entries.pop_back();
+    }
+    entries.push_front( make_pair( key, result ) );
+    index[key] = entries.begin();
+  }
+
+  void WordCache::resize( size_t size ){
+    max_size = size;
+    while ( entries.size() > max_size ){
+      index.erase( entries.back().first );
+      entries.pop_back();
+    }
+  }
+
+  size_t TokenizerClass::setWordCacheSize( size_t size ){
+    size_t old = word_cache.capacity();
+    word_cache.resize( size );
+    return old;
+  }
+
+  void TokenizerClass::report_cache_stats( ostream& os ) const {
+    size_t total = word_cache.hits + word_cache.misses;
+    os << "word cache: size=" << word_cache.capacity()
+       << " used=" << word_cache.size()
+       << " hits=" << word_cache.hits
+       << " misses=" << word_cache.misses;
+    if ( total > 0 ){
+      os << " hit rate=" << (100.0*word_cache.hits)/total << "%";
+    }
+    os << endl;
+  }
+
+  inline void alias_span( const UnicodeString& input,
+			  const MatchSpan& span,
+			  UnicodeString& result ){
+    // make result a read-only alias of a part of input. No copying.
+    // only valid as long as input is
+    if ( span.length == 0 ){
+      result.remove();
+    }
+    else {
+      result.setTo( false, input.getBuffer() + span.start, span.length );
+    }
+  }
+
+  bool TokenizerClass::plain_word( const UnicodeString& word,
+				   bool space,
+				   const string& lang ){
+    // Fast path for words made of letters only. When the Setting tells
+    // us that such a word can only be a WORD, unless one of a few rules
+    // matches, we add it without running the whole rule cascade.
+    // returns false when the word still needs internal_tokenize_word()
+    if ( !letter_path || tokDebug > 0 ){
+      return false;
+    }
+    SettingState *state = settings[lang];
+    const Setting *set = state->setting;
+    if ( !set->letter_path
+	 || word.countChar32() < 2
+	 || !set->letters.containsAll( word )
+	 || state->rules.matchesAny( word, set->letter_rules ) ){
+      return false;
+    }
+    TokenRole role = (space ? NOROLE : NOSPACE);
+    if ( paragraphsignal_next ){
+      role |= NEWPARAGRAPH;
+      paragraphsignal_next = false;
+    }
+    tokens.push_back( Token( type_word, word, role, lang ) );
+    return true;
+  }
+
   void TokenizerClass::tokenizeWord( const UnicodeString& input,
 				     bool space,
 				     const string& lang,
 				     const UnicodeString& assigned_type ) {
+    // tokenize a word, using the word cache when possible.
+    // The cache stores the tokens for a word without the NEWPARAGRAPH
+    // role, which is re-applied here, just like internal_tokenize_word()
+    // would do.
+    // A WORD that isn't cached may take the letter path. That is slower
+    // than a cache lookup, so we try it after one.
+    const bool is_word = ( assigned_type == type_word );
+    if ( word_cache.capacity() == 0
+	 || tokDebug > 0
+	 || input == eosmark ){
+      if ( !is_word || !plain_word( input, space, lang ) ){
+	internal_tokenize_word( input, space, lang, assigned_type );
+      }
+      return;
+    }
+    WordCache::Key key;
+    key.word = input;
+    key.type = assigned_type;
+    key.space = space;
+    key.lang = lang;
+    const WordCache::Result *cached = word_cache.lookup( key );
+    if ( cached ){
+      if ( cached->clears_nospace && !tokens.empty() ){
+	tokens.back().role &= ~NOSPACE;
+      }
+      size_t start = tokens.size();
+      tokens.insert( tokens.end(),
+		     cached->tokens.begin(), cached->tokens.end() );
+      if ( paragraphsignal_next && tokens.size() > start ){
+	tokens[start].role |= NEWPARAGRAPH;
+	paragraphsignal_next = false;
+      }
+      return;
+    }
+    if ( is_word && plain_word( input, space, lang ) ){
+      WordCache::Result result;
+      result.clears_nospace = false;
+      result.tokens.push_back( tokens.back() );
+      result.tokens.back().role &= ~NEWPARAGRAPH;
+      word_cache.store( key, result );
+      return;
+    }
+    // tokenize the word, and find out what it does to the token before
+    // it, (if any) by giving that one a NOSPACE role.
+    bool placeholder = tokens.empty();
+    if ( placeholder ){
+      tokens.push_back( Token( "", "", NOSPACE ) );
+    }
+    size_t start = tokens.size();
+    TokenRole previous_role = tokens.back().role;
+    tokens.back().role |= NOSPACE;
+    bool new_paragraph = paragraphsignal_next;
+    paragraphsignal_next = false;
+    internal_tokenize_word( input, space, lang, assigned_type );
+    WordCache::Result result;
+    result.clears_nospace = !( tokens[start-1].role & NOSPACE );
+    result.tokens.assign( tokens.begin()+start, tokens.end() );
+    word_cache.store( key, result );
+    if ( result.clears_nospace ){
+      previous_role &= ~NOSPACE;
+    }
+    tokens[start-1].role = previous_role;
+    if ( placeholder ){
+      tokens.erase( tokens.begin() );
+      --start;
+    }
+    if ( new_paragraph ){
+      if ( tokens.size() > start ){
+	tokens[start].role |= NEWPARAGRAPH;
+      }
+      else {
+	paragraphsignal_next = true;
+      }
+    }
+  }
+
+  void TokenizerClass::push_word_part( WordPart::Action action,
+				       const UnicodeString& text,
+				       const UnicodeString& type,
+				       bool space ){
+    // add a part to word_stack. Reuses the space of earlier parts.
+    // fastCopyFrom() keeps an alias an alias, so no copying is done
+    // for the parts of a match.
+    word_stack.resize( word_stack.size() + 1 );
+    WordPart& part = word_stack.back();
+    part.action = action;
+    part.text.fastCopyFrom( text );
+    part.type = type;
+    part.space = space;
+  }
+
+  void TokenizerClass::internal_tokenize_word( const UnicodeString& input,
+					       bool space,
+					       const string& lang,
+					       const UnicodeString& assigned_type ) {
+    // run the rule cascade on input.
+    // A match splits a word in a pre-context, matched groups and a
+    // post-context, which may all need another round. These pending parts
+    // are kept on word_stack, in reverse order, so we handle them
+    // in the order of the input. (no recursion)
+    const size_t base = word_stack.size();
+    UnicodeString text;
+    alias_span( input, MatchSpan( 0, input.length() ), text );
+    push_word_part( WordPart::TOKENIZE, text, assigned_type, space );
+    WordPart part;
+    while ( word_stack.size() > base ){
+      part.action = word_stack.back().action;
+      part.text.fastCopyFrom( word_stack.back().text );
+      part.type = word_stack.back().type;
+      part.space = word_stack.back().space;
+      word_stack.pop_back();
+      switch ( part.action ){
+      case WordPart::TOKENIZE:
+	tokenize_word_part( part.text, part.space, lang, part.type );
+	break;
+      case WordPart::EMIT: {
+	TokenRole role = (part.space ? NOROLE : NOSPACE);
+	if ( paragraphsignal_next ){
+	  role |= NEWPARAGRAPH;
+	  paragraphsignal_next = false;
+	}
+	tokens.push_back( Token( part.type, part.text, role, lang ) );
+	break;
+      }
+      case WordPart::SKIP:
+	// a filtered punctuation. the token before it is followed by space
+	if ( !tokens.empty() ){
+	  tokens.back().role &= ~NOSPACE;
+	}
+	break;
+      }
+    }
+  }
+
+  void TokenizerClass::tokenize_word_part( const UnicodeString& input,
+					   bool space,
+					   const string& lang,
+					   const UnicodeString& assigned_type ) {
+    // one step of the rule cascade. Either adds tokens, or pushes
+    // the parts of the match on word_stack.
     bool recurse = !assigned_type.isEmpty();
 
     int32_t inpLen = input.countChar32();
@@ -2632,7 +3721,7 @@ namespace Tokenizer {
     if ( inpLen == 1) {
       //single character, no need to process all rules, do some simpler (faster) detection
       UChar32 c = input.char32At(0);
-      UnicodeString type = detect_type( c );
+      const UnicodeString& type = detect_type( c, settings[lang]->setting->chars );
       if ( type == type_space ){
 	return;
       }
@@ -2665,137 +3754,152 @@ namespace Tokenizer {
       }
     }
     else {
-      bool a_rule_matched = false;
-      for ( const auto& rule : settings[lang]->rules ) {
-	if ( tokDebug >= 4){
-	  LOG << "\tTESTING " << rule->id << endl;
+      RuleMatchers& rules = settings[lang]->rules;
+      //Find first matching rule
+      const Rule *rule = 0;
+      // scratch space, reused for every part
+      UnicodeString& pre = part_pre;
+      UnicodeString& post = part_post;
+      vector<UnicodeString>& matches = part_matches;
+      if ( span_matching ){
+	rule = rules.matchFirst( input, part_match );
+	if ( rule ){
+	  // let pre, post and matches refer to the parts of input. They
+	  // are only copied when they end up in a Token
+	  alias_span( input, part_match.pre, pre );
+	  alias_span( input, part_match.post, post );
+	  matches.resize( part_match.groups.size() );
+	  for ( size_t g=0; g < part_match.groups.size(); ++g ){
+	    alias_span( input, part_match.groups[g], matches[g] );
+	  }
+	}
+      }
+      else {
+	for ( const auto& m : rules.matchers() ) {
+	  if ( !m->rule.mayMatch( input ) ){
+	    ++m->skipped;
+	    continue;
+	  }
+	  ++m->tried;
+	  if ( tokDebug >= 4){
+	    LOG << "\tTESTING " << m->rule.id << endl;
+	  }
+	  if ( m->matchAll( input, pre, post, matches ) ){
+	    rule = &m->rule;
+	    break;
+	  }
 	}
+      }
+      if ( rule ){
 	UnicodeString type = rule->id;
-	//Find first matching rule
-	UnicodeString pre, post;
-	vector<UnicodeString> matches;
-	if ( rule->matchAll( input, pre, post, matches ) ){
-	  a_rule_matched = true;
-	  if ( tokDebug >= 4 ){
-	    LOG << "\tMATCH: " << type << endl;
-	    LOG << "\tpre=  '" << pre << "'" << endl;
-	    LOG << "\tpost= '" << post << "'" << endl;
-	    int cnt = 0;
-	    for ( const auto& m : matches ){
-	      LOG << "\tmatch[" << ++cnt << "]=" << m << endl;
-	    }
+	if ( tokDebug >= 4 ){
+	  LOG << "\tMATCH: " << type << endl;
+	  LOG << "\tpre=  '" << pre << "'" << endl;
+	  LOG << "\tpost= '" << post << "'" << endl;
+	  int cnt = 0;
+	  for ( const auto& m : matches ){
+	    LOG << "\tmatch[" << ++cnt << "]=" << m << endl;
 	  }
-	  if ( recurse
-	       && ( type == type_word
-		    || ( pre.isEmpty()
-			 && post.isEmpty() ) ) ){
-	    // so only do this recurse step when:
-	    //   OR we have a WORD
-	    //   OR we have an exact match of the rule (no pre or post)
-	    if ( assigned_type != type_word ){
-	      // don't change the type when:
-	      //   it was already non-WORD
-	      if ( tokDebug >= 4 ){
-		LOG << "\trecurse, match didn't do anything new for " << input << endl;
-	      }
-	      TokenRole role = (space ? NOROLE : NOSPACE);
-	      if ( paragraphsignal_next ){
-		role |= NEWPARAGRAPH;
-		paragraphsignal_next = false;
-	      }
-	      tokens.push_back( Token( assigned_type, input, role, lang ) );
-	      return;
+	}
+	if ( recurse
+	     && ( type == type_word
+		  || ( pre.isEmpty()
+		       && post.isEmpty() ) ) ){
+	  // so only do this recurse step when:
+	  //   OR we have a WORD
+	  //   OR we have an exact match of the rule (no pre or post)
+	  if ( assigned_type != type_word ){
+	    // don't change the type when:
+	    //   it was already non-WORD
+	    if ( tokDebug >= 4 ){
+	      LOG << "\trecurse, match didn't do anything new for " << input << endl;
 	    }
-	    else {
-	      if ( tokDebug >= 4 ){
-		LOG << "\trecurse, match changes the type:"
-				<< assigned_type << " to " << type << endl;
-	      }
-	      TokenRole role = (space ? NOROLE : NOSPACE);
-	      if ( paragraphsignal_next ){
-		role |= NEWPARAGRAPH;
-		paragraphsignal_next = false;
-	      }
-	      tokens.push_back( Token( type, input, role, lang ) );
-	      return;
+	    TokenRole role = (space ? NOROLE : NOSPACE);
+	    if ( paragraphsignal_next ){
+	      role |= NEWPARAGRAPH;
+	      paragraphsignal_next = false;
 	    }
+	    tokens.push_back( Token( assigned_type, input, role, lang ) );
+	    return;
 	  }
-	  if ( pre.length() > 0 ){
+	  else {
 	    if ( tokDebug >= 4 ){
-	      LOG << "\tTOKEN pre-context (" << pre.length()
-			      << "): [" << pre << "]" << endl;
+	      LOG << "\trecurse, match changes the type:"
+			      << assigned_type << " to " << type << endl;
+	    }
+	    TokenRole role = (space ? NOROLE : NOSPACE);
+	    if ( paragraphsignal_next ){
+	      role |= NEWPARAGRAPH;
+	      paragraphsignal_next = false;
 	    }
-	    tokenizeWord( pre, false, lang ); //pre-context, no space after
+	    tokens.push_back( Token( type, input, role, lang ) );
+	    return;
+	  }
+	}
+	// push the parts in input order, and reverse them afterwards
+	const size_t mark = word_stack.size();
+	if ( pre.length() > 0 ){
+	  if ( tokDebug >= 4 ){
+	    LOG << "\tTOKEN pre-context (" << pre.length()
+			    << "): [" << pre << "]" << endl;
+	  }
+	  //pre-context, no space after
+	  push_word_part( WordPart::TOKENIZE, pre, "", false );
+	}
+	if ( matches.size() > 0 ){
+	  int max = matches.size();
+	  if ( tokDebug >= 4 ){
+	    LOG << "\tTOKEN match #=" << matches.size() << endl;
 	  }
-	  if ( matches.size() > 0 ){
-	    int max = matches.size();
+	  for ( int m=0; m < max; ++m ){
 	    if ( tokDebug >= 4 ){
-	      LOG << "\tTOKEN match #=" << matches.size() << endl;
+	      LOG << "\tTOKEN match[" << m << "] = " << matches[m]
+		  << " Space=" << (space?"TRUE":"FALSE") << endl;
+	    }
+	    if ( doPunctFilter
+		 && (&rule->id)->startsWith("PUNCTUATION") ){
+	      if (tokDebug >= 2 ){
+		LOG << "   [tokenizeWord] skipped PUNCTUATION ["
+				<< matches[m] << "]" << endl;
+	      }
+	      push_word_part( WordPart::SKIP, "", "", false );
 	    }
-	    for ( int m=0; m < max; ++m ){
-	      if ( tokDebug >= 4 ){
-		LOG << "\tTOKEN match[" << m << "] = " << matches[m]
-		    << " Space=" << (space?"TRUE":"FALSE") << endl;
+	    else {
+	      bool internal_space = space;
+	      if ( post.length() > 0 ) {
+		internal_space = false;
+	      }
+	      else if ( m < max-1 ){
+		internal_space = false;
 	      }
-	      if ( doPunctFilter
-		   && (&rule->id)->startsWith("PUNCTUATION") ){
-		if (tokDebug >= 2 ){
-		  LOG << "   [tokenizeWord] skipped PUNCTUATION ["
-				  << matches[m] << "]" << endl;
-		}
-		if ( !tokens.empty() ){
-		  tokens.back().role &= ~NOSPACE;
-		}
+	      const UnicodeString& word = matches[m];
+	      if ( norm_set.find( type ) != norm_set.end() ){
+		push_word_part( WordPart::EMIT, "{{" + type + "}}",
+				type, internal_space );
+	      }
+	      else if ( recurse ){
+		push_word_part( WordPart::EMIT, word, type, internal_space );
 	      }
 	      else {
-		bool internal_space = space;
-		if ( post.length() > 0 ) {
-		  internal_space = false;
-		}
-		else if ( m < max-1 ){
-		  internal_space = false;
-		}
-		UnicodeString word = matches[m];
-		if ( norm_set.find( type ) != norm_set.end() ){
-		  word = "{{" + type + "}}";
-		  TokenRole role = (internal_space ? NOROLE : NOSPACE);
-		  if ( paragraphsignal_next ){
-		    role |= NEWPARAGRAPH;
-		    paragraphsignal_next = false;
-		  }
-		  tokens.push_back( Token( type, word, role, lang ) );
-		}
-		else {
-		  if ( recurse ){
-		    TokenRole role = (internal_space ? NOROLE : NOSPACE);
-		    if ( paragraphsignal_next ){
-		      role |= NEWPARAGRAPH;
-		      paragraphsignal_next = false;
-		    }
-		    tokens.push_back( Token( type, word, role, lang ) );
-		  }
-		  else {
-		    tokenizeWord( word, internal_space, lang, type );
-		  }
-		}
+		push_word_part( WordPart::TOKENIZE, word, type, internal_space );
 	      }
 	    }
 	  }
-	  else if ( tokDebug >=4 ){
-	    // should never come here?
-	    LOG << "\tPANIC there's no match" << endl;
-	  }
-	  if ( post.length() > 0 ){
-	    if ( tokDebug >= 4 ){
-	      LOG << "\tTOKEN post-context (" << post.length()
-			      << "): [" << post << "]" << endl;
-	    }
-	    tokenizeWord( post, space, lang );
+	}
+	else if ( tokDebug >=4 ){
+	  // should never come here?
+	  LOG << "\tPANIC there's no match" << endl;
+	}
+	if ( post.length() > 0 ){
+	  if ( tokDebug >= 4 ){
+	    LOG << "\tTOKEN post-context (" << post.length()
+			    << "): [" << post << "]" << endl;
 	  }
-	  break;
+	  push_word_part( WordPart::TOKENIZE, post, "", space );
 	}
+	reverse( word_stack.begin() + mark, word_stack.end() );
       }
-      if ( !a_rule_matched ){
+      else {
 	// no rule matched
 	if ( tokDebug >=4 ){
 	  LOG << "\tthere's no match at all" << endl;
@@ -2814,30 +3918,64 @@ namespace Tokenizer {
     return UCTODATA_VERSION;
   }
 
-  bool TokenizerClass::init( const string& fname, const string& tname ){
-    if ( tokDebug ){
-      LOG << "Initiating tokenizer..." << endl;
+  void TokenizerClass::report_rule_stats( ostream& os ) const {
+    size_t total_tried = 0;
+    size_t total_skipped = 0;
+    for ( const auto& it : settings ){
+      if ( it.first == "default"
+	   && any_of( settings.begin(), settings.end(),
+		      [&it]( const pair<const string,SettingState*>& s ){
+			return s.first != "default" && s.second == it.second; } ) ){
+	// just an alias for a real language
+	continue;
+      }
+      os << "rule statistics for language: " << it.first << endl;
+      for ( const auto& m : it.second->rules.matchers() ){
+	os << "\t" << m->rule.id << "\ttried: " << m->tried
+	   << "\tskipped: " << m->skipped << endl;
+	total_tried += m->tried;
+	total_skipped += m->skipped;
+      }
     }
-    data_version = get_data_version();
+    os << "prefilters avoided " << total_skipped << " of "
+       << total_tried + total_skipped << " regex invocations" << endl;
+  }
+
+  TokenizerModel::TokenizerModel(): text_cat( 0 ){
+#ifdef HAVE_TEXTCAT
+    // it only loads its data when a session first detects a language
+    text_cat = new TextCat( string(SYSCONF_PATH) + "/ucto/textcat.cfg" );
+#endif
+  }
+
+  TokenizerModel::~TokenizerModel(){
+    set<Setting*> done; // "default" is an alias for a real language
+    for ( const auto& s : _settings ){
+      if ( done.insert( s.second ).second ){
+	delete s.second;
+      }
+    }
+    delete text_cat;
+  }
+
+  bool TokenizerModel::init( const string& fname,
+			     const string& tname,
+			     TiCC::LogStream *theErrLog,
+			     int tokDebug ){
     Setting *set = new Setting();
     if ( !set->read( fname, tname, tokDebug, theErrLog ) ){
       LOG << "Cannot read Tokenizer settingsfile " << fname << endl;
       LOG << "Unsupported language? (Did you install the uctodata package?)"
 	  << endl;
+      delete set;
       return false;
     }
-    else {
-      settings["default"] = set;
-      default_language = "default";
-      auto pos = fname.find("tokconfig-");
-      if ( pos != string::npos ){
-	default_language = fname.substr(pos+10);
-	settings[default_language] = set;
-      }
-      else if ( xmlout ){
-	LOG << " unable to determine a language. cannot proceed" << endl;
-	return false;
-      }
+    _settings["default"] = set;
+    _default_language = "default";
+    auto pos = fname.find("tokconfig-");
+    if ( pos != string::npos ){
+      _default_language = fname.substr(pos+10);
+      _settings[_default_language] = set;
     }
     if ( tokDebug ){
       LOG << "effective rules: " << endl;
@@ -2855,12 +3993,10 @@ namespace Tokenizer {
     return true;
   }
 
-  bool TokenizerClass::init( const vector<string>& languages,
-			     const string& tname ){
-    if ( tokDebug > 0 ){
-      LOG << "Initiating tokenizer from language list..." << endl;
-    }
-    data_version = get_data_version();
+  bool TokenizerModel::init( const vector<string>& languages,
+			     const string& tname,
+			     TiCC::LogStream *theErrLog,
+			     int tokDebug ){
     Setting *default_set = 0;
     for ( const auto& lang : languages ){
       if ( tokDebug > 0 ){
@@ -2876,23 +4012,81 @@ namespace Tokenizer {
 	LOG << "problem reading datafile for language: " << lang << endl;
 	LOG << "Unsupported language (Did you install the uctodata package?)"
 	    << endl;
+	delete set;
       }
       else {
 	if ( default_set == 0 ){
 	  default_set = set;
-	  settings["default"] = set;
-	  default_language = lang;
+	  _settings["default"] = set;
+	  _default_language = lang;
 	}
-	settings[lang] = set;
+	_settings[lang] = set;
       }
     }
-    if ( settings.empty() ){
+    if ( _settings.empty() ){
       cerr << "ucto: No useful settingsfile(s) could be found (initiating from language list: " << languages << ")" << endl;
       return false;
     }
     return true;
   }
 
+  bool TokenizerModel::get_setting_info( const std::string& language,
+					 std::string& set_file,
+					 std::string& version ) const {
+    set_file.clear();
+    version.clear();
+    auto const& it = _settings.find( language );
+    if ( it == _settings.end() ){
+      return false;
+    }
+    else {
+      set_file = it->second->set_file;
+      version = it->second->version;
+      return true;
+    }
+  }
+
+  bool TokenizerClass::init( const string& fname, const string& tname ){
+    if ( tokDebug ){
+      LOG << "Initiating tokenizer..." << endl;
+    }
+    TokenizerModel *m = new TokenizerModel();
+    if ( !m->init( fname, tname, theErrLog, tokDebug ) ){
+      delete m;
+      return false;
+    }
+    set_model( m, true );
+    return check_model();
+  }
+
+  bool TokenizerClass::init( const vector<string>& languages,
+			     const string& tname ){
+    if ( tokDebug > 0 ){
+      LOG << "Initiating tokenizer from language list..." << endl;
+    }
+    TokenizerModel *m = new TokenizerModel();
+    if ( !m->init( languages, tname, theErrLog, tokDebug ) ){
+      delete m;
+      return false;
+    }
+    set_model( m, true );
+    return check_model();
+  }
+
+  bool TokenizerClass::init( const TokenizerModel *m ){
+    set_model( m, false );
+    return check_model();
+  }
+
+  bool TokenizerClass::check_model() const {
+    // FoLiA output needs a language
+    if ( xmlout && default_language == "default" ){
+      LOG << " unable to determine a language. cannot proceed" << endl;
+      return false;
+    }
+    return true;
+  }
+
   string get_language( const vector<Token>& tv ){
     // examine the assigned languages of ALL tokens.
     // they should all be the same
@@ -2914,17 +4108,12 @@ namespace Tokenizer {
   bool TokenizerClass::get_setting_info( const std::string& language,
 					 std::string& set_file,
 					 std::string& version ) const {
-    set_file.clear();
-    version.clear();
-    auto const& it = settings.find( language );
-    if ( it == settings.end() ){
+    if ( !model ){
+      set_file.clear();
+      version.clear();
       return false;
     }
-    else {
-      set_file = it->second->set_file;
-      version = it->second->version;
-      return true;
-    }
+    return model->get_setting_info( language, set_file, version );
   }
 
 } //namespace Tokenizer
@@ -0,0 +1,429 @@
+/*
+  Copyright (c) 2006 - 2021
+  CLST - Radboud University
+  ILK  - Tilburg University
+
+  This file is part of Ucto
+
+  Ucto is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Ucto is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ucto/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+// tst_api: checks of the library API that the ucto program doesn't use.
+// Run by 'make check', with the configuration of tst.sh
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <sstream>
+#include <functional>
+#include <fstream>
+#include <set>
+#include "ticcutils/Unicode.h"
+#include "ticcutils/StringOps.h"
+#include "ticcutils/FileUtils.h"
+#include "ucto/tokenize.h"
+
+using namespace std;
+using namespace Tokenizer;
+
+static int failures = 0;
+
+void check( bool ok, const string& what ){
+  if ( !ok ){
+    cerr << "FAILED: " << what << endl;
+    ++failures;
+  }
+}
+
+bool same_sentence( const vector<Token>& a, const vector<Token>& b ){
+  if ( a.size() != b.size() ){
+    return false;
+  }
+  for ( size_t i=0; i < a.size(); ++i ){
+    if ( a[i].us != b[i].us
+	 || a[i].type != b[i].type
+	 || a[i].role != b[i].role ){
+      return false;
+    }
+  }
+  return true;
+}
+
+void test_batch( TokenizerClass& tokenizer ){
+  // tokenizeBatch() gives every text the sentences a tokenizeLine() of
+  // that text alone gives
+  vector<string> texts = {
+    "This is a test on date 29-10-2011!",
+    "",
+    "One sentence ! And a second one ! And a third",
+    "Just some words"
+  };
+  vector<vector<vector<Token>>> result = tokenizer.tokenizeBatch( texts );
+  check( result.size() == texts.size(), "batch: one result per text" );
+  for ( size_t i=0; i < texts.size() && i < result.size(); ++i ){
+    tokenizer.reset();
+    tokenizer.tokenizeLine( texts[i] );
+    vector<vector<Token>> expected;
+    vector<Token> v = tokenizer.popSentence();
+    while ( !v.empty() ){
+      expected.push_back( v );
+      v = tokenizer.popSentence();
+    }
+    const string what = "batch: text " + to_string( i );
+    check( result[i].size() == expected.size(), what + ", sentence count" );
+    for ( size_t j=0; j < expected.size() && j < result[i].size(); ++j ){
+      check( same_sentence( result[i][j], expected[j] ),
+	     what + ", sentence " + to_string( j ) );
+    }
+  }
+  check( result.size() == 4 && result[1].empty(), "batch: empty text" );
+  check( result.size() == 4 && result[2].size() == 3,
+	 "batch: three sentences" );
+  // again, reusing the result, in two threads
+  // stale content in the result must go
+  vector<vector<vector<Token>>> parallel;
+  parallel.push_back( { { Token( "WORD", "stale" ) } } );
+  tokenizer.tokenizeBatch( texts, parallel, 2 );
+  check( parallel.size() == result.size(), "batch: threads result size" );
+  for ( size_t i=0; i < result.size() && i < parallel.size(); ++i ){
+    bool same = parallel[i].size() == result[i].size();
+    for ( size_t j=0; same && j < result[i].size(); ++j ){
+      same = same_sentence( parallel[i][j], result[i][j] );
+    }
+    check( same, "batch: in threads, text " + to_string( i ) );
+  }
+  // the threads take over the options of this session
+  vector<string> lines = { "one line\nand another", "just one" };
+  tokenizer.setSentencePerLineInput( true );
+  result = tokenizer.tokenizeBatch( lines );
+  parallel = tokenizer.tokenizeBatch( lines, 2 );
+  tokenizer.setSentencePerLineInput( false );
+  check( result.size() == 2 && result[0].size() == 2,
+	 "batch: a sentence per line" );
+  check( parallel.size() == 2 && parallel[0].size() == 2
+	 && parallel[1].size() == 1,
+	 "batch: threads with the options of the session" );
+  // options for one batch only
+  result = tokenizer.tokenizeBatch( lines, 1,
+				    []( TokenizerClass& session ){
+				      session.setSentencePerLineInput( true );
+				    } );
+  check( result.size() == 2 && result[0].size() == 2,
+	 "batch: options for this batch" );
+  check( !tokenizer.getSentencePerLineInput(),
+	 "batch: options don't change the session" );
+  result = tokenizer.tokenizeBatch( lines );
+  check( result.size() == 2 && result[0].size() == 1,
+	 "batch: without those options" );
+}
+
+class RecordingSink: public SentenceSink {
+  // remembers every call, in order
+public:
+  void sentence( const vector<Token>& v ){
+    string s = "sentence:";
+    for ( const auto& token : v ){
+      s += " " + TiCC::UnicodeToUTF8( token.us );
+    }
+    calls.push_back( s );
+  };
+  void paragraph() { calls.push_back( "paragraph" ); };
+  void end_of_document() { calls.push_back( "end" ); };
+  vector<string> calls;
+};
+
+void test_sink( TokenizerClass& tokenizer ){
+  // tokenize( istream, SentenceSink ) calls the sink in input order, tells
+  // where paragraphs start, and flushes the last sentence at the end
+  const string text = "One ! Two !\n\nThree !\nFour\n";
+  vector<string> expected = {
+    "paragraph",
+    "sentence: One !",
+    "sentence: Two !",
+    "paragraph",
+    "sentence: Three !",
+    "sentence: Four",
+    "end"
+  };
+  tokenizer.reset();
+  istringstream is( text );
+  RecordingSink sink;
+  tokenizer.tokenize( is, sink );
+  check( sink.calls == expected, "sink: calls with paragraph detection" );
+  // without paragraph detection, no paragraph() calls
+  bool old = tokenizer.setParagraphDetection( false );
+  tokenizer.reset();
+  istringstream is2( text );
+  RecordingSink sink2;
+  tokenizer.tokenize( is2, sink2 );
+  tokenizer.setParagraphDetection( old );
+  vector<string> expected2;
+  for ( const auto& call : expected ){
+    if ( call != "paragraph" ){
+      expected2.push_back( call );
+    }
+  }
+  check( sink2.calls == expected2, "sink: calls without paragraph detection" );
+  // the end of an empty input is reported too
+  tokenizer.reset();
+  istringstream empty( "" );
+  RecordingSink sink3;
+  tokenizer.tokenize( empty, sink3 );
+  check( sink3.calls == vector<string>( 1, "end" ), "sink: empty input" );
+}
+
+string tokens_of( TokenizerClass& tokenizer, const string& text ){
+  // all tokens of text, as word/TYPE
+  tokenizer.reset();
+  tokenizer.tokenizeLine( text );
+  string result;
+  vector<Token> v = tokenizer.popSentence();
+  while ( !v.empty() ){
+    for ( const auto& token : v ){
+      result += TiCC::UnicodeToUTF8( token.us ) + "/"
+	+ TiCC::UnicodeToUTF8( token.type ) + " ";
+    }
+    v = tokenizer.popSentence();
+  }
+  return result;
+}
+
+void test_abbreviations( const string& dir ){
+  // the META-RULE inserts the ABBREVIATIONS as a|b|c, so with an
+  // ungrouped % ABBREVIATIONS %\. only the last one needs the period.
+  // The trie lookup of a grouped one must give what the pattern gives
+  const string text = "Dit is T.a.v de heer , dhr. Jansen van 3 jl . klaar";
+  TokenizerClass ungrouped;
+  if ( !ungrouped.init( dir + "tst_abbr.cfg" ) ){
+    check( false, "abbreviations: init of tst_abbr.cfg" );
+    return;
+  }
+  check( tokens_of( ungrouped, text ) ==
+	 "Dit/WORD is/WORD T.a.v/ABBREVIATION-KNOWN de/WORD heer/WORD "
+	 ",/PUNCTUATION dhr./ABBREVIATION-KNOWN Jansen/WORD van/WORD "
+	 "3/NUMBER jl/ABBREVIATION-KNOWN ./PUNCTUATION klaar/WORD ",
+	 "abbreviations: ungrouped" );
+  TokenizerClass grouped;
+  if ( !grouped.init( dir + "tst_abbr_grp.cfg" ) ){
+    check( false, "abbreviations: init of tst_abbr_grp.cfg" );
+    return;
+  }
+  const string expected =
+    "Dit/WORD is/WORD T/WORD ./PUNCTUATION a/WORD ./PUNCTUATION v/WORD "
+    "de/WORD heer/WORD ,/PUNCTUATION dhr./ABBREVIATION-KNOWN Jansen/WORD "
+    "van/WORD 3/NUMBER jl/WORD ./PUNCTUATION klaar/WORD ";
+  check( tokens_of( grouped, text ) == expected, "abbreviations: grouped" );
+  grouped.setSpanMatching( false );
+  check( tokens_of( grouped, text ) == expected,
+	 "abbreviations: grouped, the reference way" );
+}
+
+void test_session( TokenizerClass& tokenizer ){
+  // a TokenizerSession on the model of tokenizer tokenizes the same
+  const string text = "This is a test on date 29-10-2011! And another one.";
+  TokenizerSession session( *tokenizer.getModel() );
+  check( session.getModel() == tokenizer.getModel(),
+	 "session: shares the model" );
+  check( tokens_of( session, text ) == tokens_of( tokenizer, text ),
+	 "session: the same tokens" );
+}
+
+string cache_use( const TokenizerClass& tokenizer ){
+  // the used=... hits=... misses=... part of the cache statistics
+  ostringstream os;
+  tokenizer.report_cache_stats( os );
+  string stats = os.str();
+  size_t from = stats.find( "used=" );
+  size_t to = stats.find( " hit rate" );
+  if ( to == string::npos ){
+    to = stats.find( '\n' );
+  }
+  return from == string::npos ? stats : stats.substr( from, to - from );
+}
+
+void test_cache( const TokenizerClass& tokenizer ){
+  // the word cache keeps the most recently used words
+  TokenizerSession session( *tokenizer.getModel() );
+  session.setWordCacheSize( 2 );
+  tokens_of( session, "aap" );
+  tokens_of( session, "noot" );
+  tokens_of( session, "mies" );
+  check( cache_use( session ) == "used=2 hits=0 misses=3", "cache: full" );
+  tokens_of( session, "mies" );
+  check( cache_use( session ) == "used=2 hits=1 misses=3", "cache: a hit" );
+  tokens_of( session, "aap" );
+  check( cache_use( session ) == "used=2 hits=1 misses=4",
+	 "cache: the oldest word was evicted" );
+  tokens_of( session, "mies" );
+  check( cache_use( session ) == "used=2 hits=2 misses=4",
+	 "cache: a used word was kept" );
+  // and forgets all words when an option changes what they become. The
+  // tokens must be those of a session without a cache
+  const string text = "Hallo , wereld ! Het kost 5 euro: http://a.b/c";
+  TokenizerSession reference( *tokenizer.getModel() );
+  reference.setWordCacheSize( 0 );
+  session.setWordCacheSize( 100 );
+  vector<pair<string,function<void(TokenizerClass&)>>> changes = {
+    { "setPunctFilter", []( TokenizerClass& t ){ t.setPunctFilter( true ); } },
+    { "setNormSet", []( TokenizerClass& t ){ t.setNormSet( "NUMBER,URL" ); } },
+    { "setEosMarker", []( TokenizerClass& t ){ t.setEosMarker( "euro" ); } },
+    { "setSpanMatching", []( TokenizerClass& t ){ t.setSpanMatching( false ); } },
+    { "setLetterPath", []( TokenizerClass& t ){ t.setLetterPath( false ); } }
+  };
+  for ( const auto& change : changes ){
+    const string before = tokens_of( session, text );
+    check( before == tokens_of( reference, text ),
+	   "cache: before " + change.first );
+    change.second( session );
+    change.second( reference );
+    check( cache_use( session ).find( "used=0 " ) == 0,
+	   "cache: empty after " + change.first );
+    const string after = tokens_of( session, text );
+    check( after == tokens_of( reference, text ),
+	   "cache: after " + change.first );
+  }
+}
+
+set<UnicodeString> sample_inputs( const string& dir ){
+  // the lines of the texts in dir, their words, and the prefixes and
+  // suffixes of those words. Much like the parts the rules see
+  set<UnicodeString> result;
+  for ( const auto& file : TiCC::searchFilesMatch( dir, "*.txt", false ) ){
+    ifstream is( file );
+    string line;
+    while ( getline( is, line ) ){
+      UnicodeString us = TiCC::UnicodeFromUTF8( line );
+      result.insert( us );
+      for ( const auto& word : TiCC::split( line ) ){
+	UnicodeString w = TiCC::UnicodeFromUTF8( word );
+	for ( int i=1; i < w.length(); ++i ){
+	  result.insert( UnicodeString( w, 0, i ) );
+	  result.insert( UnicodeString( w, i ) );
+	}
+	result.insert( w );
+      }
+    }
+  }
+  return result;
+}
+
+void check_prefilters( const TokenizerModel& model,
+		       const set<UnicodeString>& inputs,
+		       const string& name ){
+  // mayMatch() may only reject inputs the pattern of the rule doesn't match
+  set<const Setting*> done;
+  for ( const auto& it : model.settings() ){
+    if ( !done.insert( it.second ).second ){
+      continue;
+    }
+    for ( const auto& rule : it.second->rules ){
+      UErrorCode u_stat = U_ZERO_ERROR;
+      RegexPattern *pattern = RegexPattern::compile( rule->pattern, 0,
+						     u_stat );
+      if ( U_FAILURE(u_stat) ){
+	check( false, name + ": rule " + TiCC::UnicodeToUTF8( rule->id )
+	       + " doesn't compile" );
+	continue;
+      }
+      RegexMatcher *matcher = pattern->matcher( u_stat );
+      for ( const auto& input : inputs ){
+	matcher->reset( input );
+	if ( matcher->find() && !rule->mayMatch( input ) ){
+	  check( false, name + ": rule " + TiCC::UnicodeToUTF8( rule->id )
+		 + " matches '" + TiCC::UnicodeToUTF8( input )
+		 + "', but its prefilter rejects it" );
+	  break;
+	}
+      }
+      delete matcher;
+      delete pattern;
+    }
+  }
+}
+
+void test_prefilters( const string& dir ){
+  // the prefilters of the rules of the test configurations, and of the
+  // installed languages, are sound on the test texts
+  const set<UnicodeString> inputs = sample_inputs( dir );
+  check( !inputs.empty(), "prefilters: no test texts" );
+  for ( const auto& file : TiCC::searchFilesMatch( dir, "*.cfg", false ) ){
+    // some are broken on purpose, for the tests of ucto
+    TokenizerClass tokenizer;
+    try {
+      if ( !tokenizer.init( file ) ){
+	continue;
+      }
+    }
+    catch ( const exception& ){
+      continue;
+    }
+    check_prefilters( *tokenizer.getModel(), inputs, file );
+  }
+  for ( const auto& language : Setting::installed_languages() ){
+    TokenizerClass tokenizer;
+    if ( tokenizer.init( vector<string>( 1, language ) ) ){
+      check_prefilters( *tokenizer.getModel(), inputs, language );
+    }
+  }
+  // a rule without a prefilter lets everything through, even "".
+  // Patterns we don't fully understand get none
+  const vector<string> unsupported = {
+    "(ab)\\1",                 // a back reference
+    "(?<x>ab)\\k<x>",          // a named one
+    "(?<=x)abc",               // lookbehind
+    "(?<!x)abc",
+    "[\\p{L}&&[a-z]]bc",       // set operations
+    "[\\p{L}--\\p{Lu}]bc",
+    "a(?i)bc",                 // case insensitivity, also when scoped
+    "(?i:a)bc",
+    "(?-i)abc",
+    "(?x) a b c",              // free spacing
+    "\\Qabc\\E"                // quoted text
+  };
+  for ( const auto& pattern : unsupported ){
+    Rule rule( "TEST", TiCC::UnicodeFromUTF8( pattern ) );
+    check( rule.mayMatch( "" ), "prefilters: none for " + pattern );
+  }
+  Rule simple( "TEST", "[a-z]bc" );
+  check( !simple.mayMatch( "" ) && !simple.mayMatch( "xyz" )
+	 && simple.mayMatch( "xbc" ), "prefilters: a simple pattern" );
+}
+
+int main(){
+  const char *srcdir = getenv( "srcdir" );
+  const string dir = string( srcdir ? srcdir : "." ) + "/../tests/";
+  string config = dir + "tst.cfg";
+  TokenizerClass tokenizer;
+  if ( !tokenizer.init( config ) ){
+    cerr << "unable to initialize the tokenizer from " << config << endl;
+    return EXIT_FAILURE;
+  }
+  test_batch( tokenizer );
+  test_sink( tokenizer );
+  test_session( tokenizer );
+  test_cache( tokenizer );
+  test_abbreviations( dir );
+  test_prefilters( dir );
+  if ( failures > 0 ){
+    cerr << failures << " check(s) failed" << endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -31,7 +31,12 @@
 #include <set>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
 #include "ticcutils/StringOps.h"
+#include "ticcutils/FileUtils.h"
 #include "libfolia/folia.h"
 #include "ticcutils/CommandLine.h"
 #include "ticcutils/PrettyPrint.h"
@@ -39,6 +44,7 @@
 #include "ucto/my_textcat.h"
 #include "ucto/setting.h"
 #include "ucto/tokenize.h"
+#include "ucto/server.h"
 #include <unistd.h>
 
 using namespace std;
@@ -119,12 +125,42 @@ void usage(){
        << "\t--allow-word-corrections   - allow tokenization of FoLiA Word elements." << endl
        << "\t--ignore-tag-hints - Do NOT use tag=\"token\" hints from the FoLiA input. (default is to use them)" << endl
        << "\t--filterpunct      - remove all punctuation from the output" << endl
+       << "\t--reference-rules - match the tokenizer RULES the reference way, copying" << endl
+       << "\t                    every match. (slower, same results)" << endl
+       << "\t--no-letter-path  - run all RULES on words made of letters only too." << endl
+       << "\t                    (slower, same results)" << endl
+       << "\t--rulestats       - print statistics on the use of the RULES to stderr" << endl
+       << "\t--cache-size=<n>  - remember the tokenization of at most n different words" << endl
+       << "\t                    (default 10000, 0 disables the word cache)" << endl
+       << "\t--cachestats      - print the hits and misses of the word cache to stderr" << endl
        << "\t--uselanguages=<lang1,lang2,..langn> - Using FoLiA input, only tokenize strings in these languages. Default = 'lang1'" << endl
        << "\t--detectlanguages=<lang1,lang2,..langn> - try to assign a language to each line of text input. Default = 'lang1'" << endl
        << "\t--add-tokens='file' - add additional tokens to the [TOKENS] of the" << endl
        << "\t                    default language. TOKENS are always kept intact." << endl
        << "\t-P                - Disable paragraph detection" << endl
        << "\t-Q                - Enable quote detection (experimental)" << endl
+       << "\t--quote-lookback=<n> - with -Q: give up on an opening quote when it is" << endl
+       << "\t                    not closed within n tokens. (default 0: never)" << endl
+       << "\t--batch           - tokenize every input file, and every file in an input" << endl
+       << "\t                    directory, to a file in the --outputdir" << endl
+       << "\t--outputdir=<dir> - with --batch: where to write the output files. (default '.')" << endl
+       << "\t                    Every output is named after its input, with '.tok' added" << endl
+       << "\t                    ('.tok.xml' for FoLiA output)" << endl
+       << "\t-j <n>            - use n threads (default 1). With --batch: tokenize n files" << endl
+       << "\t                    at the same time. Otherwise: tokenize the paragraphs of" << endl
+       << "\t                    a text file in parallel. (same results)" << endl
+       << "\t--chunk-size=<n>  - with -j or --pipeline: hand out at least n lines at a" << endl
+       << "\t                    time to a thread. (default 1000)" << endl
+       << "\t--pipeline        - read, tokenize and write text in separate threads." << endl
+       << "\t                    (implied by -j, same results)" << endl
+       << "\t--server=<socket> - run as a server on Unix domain socket <socket>. It" << endl
+       << "\t                    serves requests with the options given here. With -j," << endl
+       << "\t                    serve n requests at the same time" << endl
+       << "\t--port=<n>        - like --server, on TCP port n of localhost" << endl
+       << "\t--coprocess       - like --server, reading requests from stdin and writing" << endl
+       << "\t                    the responses to stdout" << endl
+       << "\t--max-request=<n> - with --server, --port or --coprocess: refuse requests" << endl
+       << "\t                    with a text of more than n bytes. (default 16777216)" << endl
        << "\t-V or --version   - Show version information" << endl
        << "\t-x <DocID>        - Output FoLiA XML, use the specified Document ID (obsolete)" << endl
        << "\t-F                - Input file is in FoLiA XML. All untokenized sentences will be tokenized." << endl
@@ -138,6 +174,128 @@ void usage(){
        << "\t                  (-x and -F disable usage of most other options: -nPQVs)" << endl;
 }
 
+struct BatchJob {
+  // one file to tokenize in --batch mode
+  std::string input;
+  std::string output;
+  bool xml;          // FoLiA input
+  std::string error; // what went wrong. empty when all is well
+};
+
+vector<BatchJob> batch_jobs( const vector<string>& inputs,
+			     const string& outputdir,
+			     bool xmlin,
+			     bool xmlout ){
+  // every input file, and every file in an input directory, with the name
+  // of its output file
+  vector<string> files;
+  for ( const auto& input : inputs ){
+    if ( TiCC::isDir( input ) ){
+      vector<string> dir_files;
+      for ( const auto& f : TiCC::searchFiles( input, false ) ){
+	if ( TiCC::isFile( f ) ){
+	  dir_files.push_back( f );
+	}
+      }
+      sort( dir_files.begin(), dir_files.end() );
+      files.insert( files.end(), dir_files.begin(), dir_files.end() );
+    }
+    else {
+      files.push_back( input );
+    }
+  }
+  vector<BatchJob> result;
+  set<string> outputs;
+  for ( const auto& file : files ){
+    BatchJob job;
+    job.input = file;
+    job.xml = xmlin || TiCC::match_back( file, ".xml" );
+    string name = TiCC::basename( file );
+    if ( job.xml || xmlout ){
+      if ( TiCC::match_back( name, ".xml" ) ){
+	name = name.substr( 0, name.length() - 4 );
+      }
+      name += ".tok.xml";
+    }
+    else {
+      name += ".tok";
+    }
+    job.output = outputdir + "/" + name;
+    if ( !outputs.insert( job.output ).second ){
+      job.error = "output file " + job.output
+	+ " is already used for another input";
+    }
+    result.push_back( job );
+  }
+  return result;
+}
+
+void batch_tokenize( TokenizerClass& tokenizer, BatchJob& job ){
+  // tokenize one file of a batch. Errors are stored in the job
+  tokenizer.reset();
+  tokenizer.setXMLInput( job.xml );
+  if ( !TiCC::isFile( job.input ) ){
+    job.error = "unable to find or read file " + job.input;
+    return;
+  }
+  ofstream os( job.output );
+  if ( !os.good() ){
+    job.error = "unable to open outputfile " + job.output;
+    return;
+  }
+  try {
+    if ( job.xml ){
+      folia::Document *doc = tokenizer.tokenize_folia( job.input );
+      if ( !doc ){
+	job.error = "unable to tokenize FoLiA document";
+	return;
+      }
+      os << doc;
+      delete doc;
+    }
+    else {
+      tokenizer.tokenize( job.input, os );
+    }
+    os.flush();
+    if ( !os.good() ){
+      job.error = "problems writing outputfile " + job.output;
+    }
+  }
+  catch ( const exception& e ){
+    job.error = e.what();
+  }
+}
+
+int run_batch( vector<BatchJob>& jobs,
+	       const vector<TokenizerClass*>& workers ){
+  // tokenize all jobs, every worker in its own thread, and report the
+  // failures. Returns the number of failed jobs
+  atomic<size_t> next( 0 );
+  vector<thread> threads;
+  for ( const auto& worker : workers ){
+    threads.push_back( thread( [&jobs,&next,worker](){
+	  for ( size_t i = next++; i < jobs.size(); i = next++ ){
+	    if ( jobs[i].error.empty() ){
+	      batch_tokenize( *worker, jobs[i] );
+	    }
+	  }
+	} ) );
+  }
+  for ( auto& t : threads ){
+    t.join();
+  }
+  int failed = count_if( jobs.begin(), jobs.end(),
+			 []( const BatchJob& job ){ return !job.error.empty(); } );
+  cerr << "ucto: tokenized " << jobs.size() - failed << " of "
+       << jobs.size() << " files" << endl;
+  for ( const auto& job : jobs ){
+    if ( !job.error.empty() ){
+      cerr << "ucto: FAILED " << job.input << ": " << job.error << endl;
+    }
+  }
+  return failed;
+}
+
 int main( int argc, char *argv[] ){
   int debug = 0;
   bool tolowercase = false;
@@ -166,8 +324,24 @@ int main( int argc, char *argv[] ){
   string ofile;
   string c_file;
   bool pass_thru = false;
+  bool reference_rules = false;
+  bool no_letter_path = false;
+  bool rule_stats = false;
+  bool cache_stats = false;
+  int cache_size = -1;
+  int quote_lookback = -1;
   bool ignore_tags = false;
   bool sentencesplit = false;
+  bool batch = false;
+  string outputdir = ".";
+  int jobs = 1;
+  int chunk_size = 1000;
+  bool pipeline = false;
+  string server_socket;
+  int server_port = 0;
+  bool coprocess = false;
+  size_t max_request = default_max_request;
+  vector<string> batch_inputs;
   string norm_set_string;
   string add_tokens;
   string command_line = "ucto";
@@ -175,8 +349,8 @@ int main( int argc, char *argv[] ){
     command_line += " " + string(argv[i]);
   }
   try {
-    TiCC::CL_Options Opts( "d:e:fhlPQunmN:vVL:c:s:x:FXT:",
-			   "filter:,filterpunct,passthru,textclass:,inputclass:,outputclass:,normalize:,id:,version,help,detectlanguages:,uselanguages:,textredundancy:,add-tokens:,split,allow-word-corrections,ignore-tag-hints");
+    TiCC::CL_Options Opts( "d:e:fhlPQunmN:vVL:c:s:x:FXT:j:",
+			   "filter:,filterpunct,passthru,textclass:,inputclass:,outputclass:,normalize:,id:,version,help,detectlanguages:,uselanguages:,textredundancy:,add-tokens:,split,allow-word-corrections,ignore-tag-hints,reference-rules,no-letter-path,rulestats,cache-size:,cachestats,quote-lookback:,batch,outputdir:,chunk-size:,pipeline,server:,port:,coprocess,max-request:");
     Opts.init(argc, argv );
     if ( Opts.extract( 'h' )
 	 || Opts.extract( "help" ) ){
@@ -286,6 +460,70 @@ int main( int argc, char *argv[] ){
     }
     ignore_tags = Opts.extract( "ignore-tag-hints" );
     pass_thru = Opts.extract( "passthru" );
+    reference_rules = Opts.extract( "reference-rules" );
+    no_letter_path = Opts.extract( "no-letter-path" );
+    rule_stats = Opts.extract( "rulestats" );
+    cache_stats = Opts.extract( "cachestats" );
+    if ( Opts.extract( "cache-size", value ) ){
+      if ( !TiCC::stringTo( value, cache_size ) || cache_size < 0 ){
+	throw TiCC::OptionError( "invalid value for --cache-size: " + value );
+      }
+    }
+    if ( Opts.extract( "quote-lookback", value ) ){
+      if ( !TiCC::stringTo( value, quote_lookback ) || quote_lookback < 0 ){
+	throw TiCC::OptionError( "invalid value for --quote-lookback: " + value );
+      }
+    }
+    batch = Opts.extract( "batch" );
+    if ( Opts.extract( "outputdir", outputdir ) && !batch ){
+      throw TiCC::OptionError( "--outputdir is only valid with --batch" );
+    }
+    if ( Opts.extract( 'j', value ) ){
+      if ( !TiCC::stringTo( value, jobs ) || jobs < 1 ){
+	throw TiCC::OptionError( "invalid value for -j: " + value );
+      }
+    }
+    if ( Opts.extract( "chunk-size", value ) ){
+      if ( !TiCC::stringTo( value, chunk_size ) || chunk_size < 1 ){
+	throw TiCC::OptionError( "invalid value for --chunk-size: " + value );
+      }
+      if ( batch ){
+	throw TiCC::OptionError( "--chunk-size is not valid with --batch" );
+      }
+    }
+    pipeline = Opts.extract( "pipeline" );
+    if ( pipeline && batch ){
+      throw TiCC::OptionError( "--pipeline is not valid with --batch" );
+    }
+    Opts.extract( "server", server_socket );
+    if ( Opts.extract( "port", value ) ){
+      if ( !TiCC::stringTo( value, server_port )
+	   || server_port < 1 || server_port > 65535 ){
+	throw TiCC::OptionError( "invalid value for --port: " + value );
+      }
+      if ( !server_socket.empty() ){
+	throw TiCC::OptionError( "--server and --port conflict. Use only one of these." );
+      }
+    }
+    if ( ( !server_socket.empty() || server_port > 0 )
+	 && ( batch || pipeline ) ){
+      throw TiCC::OptionError( "--server and --port are not valid with --batch or --pipeline" );
+    }
+    coprocess = Opts.extract( "coprocess" );
+    if ( coprocess
+	 && ( batch || pipeline || jobs > 1
+	      || !server_socket.empty() || server_port > 0 ) ){
+      throw TiCC::OptionError( "--coprocess is not valid with --batch, --pipeline, -j, --server or --port" );
+    }
+    if ( Opts.extract( "max-request", value ) ){
+      if ( value.find_first_not_of( "0123456789" ) != string::npos
+	   || !TiCC::stringTo( value, max_request ) || max_request < 1 ){
+	throw TiCC::OptionError( "invalid value for --max-request: " + value );
+      }
+      if ( server_socket.empty() && server_port == 0 && !coprocess ){
+	throw TiCC::OptionError( "--max-request is only valid with --server, --port or --coprocess" );
+      }
+    }
     bool use_lang = Opts.is_present( "uselanguages" );
     bool detect_lang = Opts.is_present( "detectlanguages" );
     if ( detect_lang && use_lang ){
@@ -352,16 +590,28 @@ int main( int argc, char *argv[] ){
       throw TiCC::OptionError( "unhandled option(s): " + tomany );
     }
     vector<string> files = Opts.getMassOpts();
+    if ( ( !server_socket.empty() || server_port > 0 || coprocess )
+	 && !files.empty() ){
+      throw TiCC::OptionError( "a server takes its input from its clients, not from files" );
+    }
+    if ( batch ){
+      // all arguments are inputs. FoLiA input is decided per file
+      if ( files.empty() ){
+	throw TiCC::OptionError( "--batch needs input files or directories" );
+      }
+      batch_inputs = files;
+      files.clear();
+    }
     if ( files.size() > 0 ){
       ifile = files[0];
       if ( TiCC::match_back( ifile, ".xml" ) ){
 	xmlin = true;
       }
     }
-    if ( use_lang && !xmlin ){
+    if ( use_lang && !xmlin && !batch ){
       throw TiCC::OptionError( "--uselanguages is only valid for FoLiA input" );
     }
-    if ( docorrectwords && !xmlin ){
+    if ( docorrectwords && !xmlin && !batch ){
       throw TiCC::OptionError( "--allow-word-corrections is only valid for FoLiA input" );
     }
     if ( files.size() == 2 ){
@@ -428,32 +678,48 @@ int main( int argc, char *argv[] ){
     }
   }
 
-  if ((!ifile.empty()) && (ifile == ofile)) {
+  vector<BatchJob> batch_list;
+  if ( batch ){
+    if ( !TiCC::isDir( outputdir ) ){
+      cerr << "ucto: output directory " << outputdir << " doesn't exist" << endl;
+      return EXIT_FAILURE;
+    }
+    batch_list = batch_jobs( batch_inputs, outputdir, xmlin, xmlout );
+    if ( batch_list.empty() ){
+      cerr << "ucto: no input files found" << endl;
+      return EXIT_FAILURE;
+    }
+    cerr << "ucto: batch of " << batch_list.size() << " files, to "
+	 << outputdir << endl;
+  }
+  else if ((!ifile.empty()) && (ifile == ofile)) {
     cerr << "ucto: Output file equals input file! Courageously refusing to start..."  << endl;
     return EXIT_FAILURE;
   }
+  else if ( ( jobs > 1 || pipeline ) && ( xmlin || xmlout ) ){
+    cerr << "ucto: -j and --pipeline only work on text input and output"
+	 << " (or -j with --batch)" << endl;
+    return EXIT_FAILURE;
+  }
 
-  cerr << "ucto: inputfile = "  << ifile << endl;
-  cerr << "ucto: outputfile = " << ofile << endl;
+  const bool serving = !server_socket.empty() || server_port > 0 || coprocess;
+  if ( !batch && !serving ){
+    cerr << "ucto: inputfile = "  << ifile << endl;
+    cerr << "ucto: outputfile = " << ofile << endl;
+  }
 
-  istream *IN = 0;
-  if (!xmlin) {
-    if ( ifile.empty() ){
-      IN = &cin;
-    }
-    else {
-      IN = new ifstream( ifile );
-      if ( !IN || !IN->good() ){
-	cerr << "ucto: problems opening inputfile " << ifile << endl;
-	cerr << "ucto: Courageously refusing to start..."  << endl;
-	delete IN;
-	return EXIT_FAILURE;
-      }
+  if ( !xmlin && !ifile.empty() ){
+    // the tokenizer opens it, but we check it first
+    ifstream IN( ifile );
+    if ( !IN.good() ){
+      cerr << "ucto: problems opening inputfile " << ifile << endl;
+      cerr << "ucto: Courageously refusing to start..."  << endl;
+      return EXIT_FAILURE;
     }
   }
 
   ostream *OUT = 0;
-  if ( ofile.empty() ){
+  if ( ofile.empty() || batch ){
     OUT = &cout;
   }
   else {
@@ -462,60 +728,67 @@ int main( int argc, char *argv[] ){
       cerr << "ucto: problems opening outputfile " << ofile << endl;
       cerr << "ucto: Courageously refusing to start..."  << endl;
       delete OUT;
-      if ( IN != &cin ){
-	delete IN;
-      }
       return EXIT_FAILURE;
     }
   }
   try {
+    // set all options of a tokenizer, except for the model
+    auto configure = [&]( TokenizerClass& tokenizer ){
+      // set debug first, so init() can be debugged too
+      tokenizer.setDebug( debug );
+      tokenizer.set_command( command_line );
+      tokenizer.setEosMarker( eosmarker );
+      tokenizer.setVerbose( verbose );
+      tokenizer.setSentenceSplit(sentencesplit);
+      tokenizer.setSentencePerLineOutput(sentenceperlineoutput);
+      tokenizer.setSentencePerLineInput(sentenceperlineinput);
+      tokenizer.setLowercase(tolowercase);
+      tokenizer.setUppercase(touppercase);
+      tokenizer.setNormSet(norm_set_string);
+      tokenizer.setParagraphDetection(paragraphdetection);
+      tokenizer.setQuoteDetection(quotedetection);
+      if ( quote_lookback >= 0 ){
+        tokenizer.setQuoteLookback( quote_lookback );
+      }
+      tokenizer.setNormalization( normalization );
+      tokenizer.setInputEncoding( inputEncoding );
+      tokenizer.setFiltering(dofiltering);
+      tokenizer.setWordCorrection(docorrectwords);
+      tokenizer.setLangDetection(do_language_detect);
+      tokenizer.setPunctFilter(dopunctfilter);
+      tokenizer.setInputClass(inputclass);
+      tokenizer.setOutputClass(outputclass);
+      tokenizer.setXMLOutput(xmlout, docid);
+      tokenizer.setXMLInput(xmlin);
+      tokenizer.setTextRedundancy(redundancy);
+      if ( ignore_tags ){
+        tokenizer.setNoTags( true );
+      }
+      if ( reference_rules ){
+        tokenizer.setSpanMatching( false );
+      }
+      if ( no_letter_path ){
+        tokenizer.setLetterPath( false );
+      }
+      if ( cache_size >= 0 ){
+        tokenizer.setWordCacheSize( cache_size );
+      }
+      tokenizer.setPassThru( pass_thru );
+    };
     TokenizerClass tokenizer;
-    // set debug first, so init() can be debugged too
-    tokenizer.setDebug( debug );
-    tokenizer.set_command( command_line );
-    tokenizer.setEosMarker( eosmarker );
-    tokenizer.setVerbose( verbose );
-    tokenizer.setSentenceSplit(sentencesplit);
-    tokenizer.setSentencePerLineOutput(sentenceperlineoutput);
-    tokenizer.setSentencePerLineInput(sentenceperlineinput);
-    tokenizer.setLowercase(tolowercase);
-    tokenizer.setUppercase(touppercase);
-    tokenizer.setNormSet(norm_set_string);
-    tokenizer.setParagraphDetection(paragraphdetection);
-    tokenizer.setQuoteDetection(quotedetection);
-    tokenizer.setNormalization( normalization );
-    tokenizer.setInputEncoding( inputEncoding );
-    tokenizer.setFiltering(dofiltering);
-    tokenizer.setWordCorrection(docorrectwords);
-    tokenizer.setLangDetection(do_language_detect);
-    tokenizer.setPunctFilter(dopunctfilter);
-    tokenizer.setInputClass(inputclass);
-    tokenizer.setOutputClass(outputclass);
-    tokenizer.setXMLOutput(xmlout, docid);
-    tokenizer.setXMLInput(xmlin);
-    tokenizer.setTextRedundancy(redundancy);
-    if ( ignore_tags ){
-      tokenizer.setNoTags( true );
-    }
-    if ( pass_thru ){
-      tokenizer.setPassThru( true );
-    }
-    else {
+    configure( tokenizer );
+
+    if ( !pass_thru ){
       // init exept for passthru mode
       if ( !cfile.empty()
 	   && !tokenizer.init( cfile, add_tokens ) ){
-	if ( IN != &cin ){
-	  delete IN;
-	}
 	if ( OUT != &cout ){
 	  delete OUT;
 	}
 	return EXIT_FAILURE;
       }
-      else if ( !tokenizer.init( language_list, add_tokens ) ){
-	if ( IN != &cin ){
-	  delete IN;
-	}
+      else if ( cfile.empty()
+		&& !tokenizer.init( language_list, add_tokens ) ){
 	if ( OUT != &cout ){
 	  delete OUT;
 	}
@@ -530,7 +803,65 @@ int main( int argc, char *argv[] ){
     }
 
 
-    if (xmlin) {
+    auto new_session = [&]() -> TokenizerClass* {
+      // a session on the model of tokenizer. In passthru mode there is none
+      if ( pass_thru ){
+	return new TokenizerClass();
+      }
+      return new TokenizerSession( *tokenizer.getModel() );
+    };
+    if ( coprocess ){
+      // one session, for all requests on stdin
+      RequestChannel channel( 0, 1, max_request );
+      TokenizerServer::serve( channel, tokenizer );
+      return EXIT_SUCCESS;
+    }
+    if ( serving ){
+      // every worker of the server gets its own session, on the model of
+      // tokenizer. With -j, that many requests are served at the same time
+      TokenizerServer server( [&](){
+	  TokenizerClass *session = new_session();
+	  configure( *session );
+	  return session;
+	}, jobs, max_request );
+      if ( !server_socket.empty() ){
+	server.listen_unix( server_socket );
+	cerr << "ucto: listening on socket " << server_socket << endl;
+      }
+      else {
+	server.listen_tcp( server_port );
+	cerr << "ucto: listening on port " << server_port << endl;
+      }
+      server.run();
+      // run() only returns when we can't accept connections anymore
+      return EXIT_FAILURE;
+    }
+    // with -j, every thread gets its own session, on the model of tokenizer
+    vector<TokenizerClass*> workers( 1, &tokenizer );
+    for ( int i=1; i < jobs; ++i ){
+      TokenizerClass *session = new_session();
+      configure( *session );
+      workers.push_back( session );
+    }
+    auto finish = [&](){
+      for ( const auto& worker : workers ){
+	if ( rule_stats ){
+	  worker->report_rule_stats( cerr );
+	}
+	if ( cache_stats ){
+	  worker->report_cache_stats( cerr );
+	}
+	if ( worker != &tokenizer ){
+	  delete worker;
+	}
+      }
+    };
+    if ( batch ){
+      int failed = run_batch( batch_list, workers );
+      finish();
+      return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    else if (xmlin) {
       folia::Document *doc = tokenizer.tokenize_folia( ifile );
       if ( doc ){
 	*OUT << doc;
@@ -539,12 +870,22 @@ int main( int argc, char *argv[] ){
       }
     }
     else {
-      tokenizer.tokenize( *IN, *OUT );
+      if ( jobs > 1 || pipeline ){
+	// read, tokenize and write in separate threads. With -j, tokenize
+	// the paragraphs in parallel
+	vector<TokenizerClass*> helpers( workers.begin() + 1, workers.end() );
+	tokenizer.tokenize_parallel( ifile, *OUT, helpers, chunk_size );
+      }
+      else if ( ifile.empty() ){
+	tokenizer.tokenize( cin, *OUT );
+      }
+      else {
+	tokenizer.tokenize( ifile, *OUT );
+      }
       if ( OUT != &cout )
 	delete OUT;
-      if ( IN != &cin )
-	delete IN;
     }
+    finish();
   }
   catch ( exception &e ){
     cerr << "ucto: " << e.what() << endl;
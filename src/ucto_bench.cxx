@@ -0,0 +1,437 @@
+/*
+  Copyright (c) 2006 - 2021
+  CLST - Radboud University
+  ILK  - Tilburg University
+
+  This file is part of Ucto
+
+  Ucto is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  Ucto is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ucto/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+// ucto_bench: time the tokenizer and count its heap allocations.
+// Not installed. Build it with 'make ucto_bench'
+
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <iostream>
+#include <fstream>
+#include "unicode/uclean.h"
+#include "unicode/uchar.h"
+#include "unicode/ucnv.h"
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/LogStream.h"
+#include "ticcutils/Unicode.h"
+#include "ucto/setting.h"
+#include "ucto/tokenize.h"
+
+using namespace std;
+using namespace Tokenizer;
+
+// every allocation, by operator new or by ICU
+static size_t allocations = 0;
+
+void *operator new( size_t size ){
+  ++allocations;
+  void *p = malloc( size == 0 ? 1 : size );
+  if ( !p ){
+    throw bad_alloc();
+  }
+  return p;
+}
+
+void operator delete( void *p ) noexcept {
+  free( p );
+}
+
+static void *U_CALLCONV icu_alloc( const void *, size_t size ){
+  ++allocations;
+  return malloc( size );
+}
+
+static void *U_CALLCONV icu_realloc( const void *, void *p, size_t size ){
+  ++allocations;
+  return realloc( p, size );
+}
+
+static void U_CALLCONV icu_free( const void *, void *p ){
+  free( p );
+}
+
+void usage( const string& name ){
+  cerr << "Usage: " << name << " [options] file" << endl;
+  cerr << "\t-c <configfile>   the ucto configuration to use (required)" << endl;
+  cerr << "\t-n <count>        run every test <count> times (default 1)" << endl;
+  cerr << "\t--cache-size=<n>  use a word cache of <n> entries (default 0)" << endl;
+}
+
+struct Result {
+  Result(): count(0), allocs(0), secs(0) {};
+  size_t count;
+  size_t allocs;
+  double secs;
+};
+
+void report( const string& what, const string& unit, const Result& r ){
+  cout << what << ": " << r.count << " x " << unit << ", "
+       << r.allocs << " allocations ("
+       << (r.count ? double(r.allocs)/r.count : 0.0) << " per "
+       << unit << "), " << r.secs << " seconds" << endl;
+}
+
+vector<UnicodeString> read_words( const vector<UnicodeString>& lines ){
+  // split the lines on whitespace, just like the tokenizer does
+  vector<UnicodeString> result;
+  for ( const auto& line : lines ){
+    UnicodeString word;
+    for ( int i=0; i < line.length(); i = line.moveIndex32( i, 1 ) ){
+      UChar32 c = line.char32At( i );
+      if ( u_isspace( c ) ){
+	if ( !word.isEmpty() ){
+	  result.push_back( word );
+	  word.remove();
+	}
+      }
+      else {
+	word += c;
+      }
+    }
+    if ( !word.isEmpty() ){
+      result.push_back( word );
+    }
+  }
+  return result;
+}
+
+Result match_copies( RuleMatchers& rules,
+		     const vector<UnicodeString>& words,
+		     int repeat ){
+  // match every word, with pre, post and groups as new strings
+  Result result;
+  UnicodeString pre;
+  UnicodeString post;
+  vector<UnicodeString> matches;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    for ( const auto& word : words ){
+      if ( rules.matchFirst( word, pre, post, matches ) ){
+	++result.count;
+      }
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+Result match_spans( RuleMatchers& rules,
+		    const vector<UnicodeString>& words,
+		    int repeat ){
+  // match every word, with pre, post and groups as spans
+  Result result;
+  RuleMatch match;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    for ( const auto& word : words ){
+      if ( rules.matchFirst( word, match ) ){
+	++result.count;
+      }
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+Result tokenize( TokenizerClass& tokenizer,
+		 const vector<UnicodeString>& lines,
+		 int repeat ){
+  // tokenize all lines and count the tokens
+  Result result;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    for ( const auto& line : lines ){
+      tokenizer.tokenizeLine( line );
+      while ( true ){
+	vector<Token> sentence = tokenizer.popSentence();
+	if ( sentence.empty() ){
+	  break;
+	}
+	result.count += sentence.size();
+      }
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+Result tokenize_utf8( TokenizerClass& tokenizer,
+		      const vector<string>& lines,
+		      int repeat,
+		      bool converter ){
+  // tokenize all UTF-8 lines and count the tokens. Either decode every line
+  // with a fresh converter, like tokenizeLine( string ) used to do, or
+  // leave the decoding to tokenizeLine( string )
+  Result result;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    for ( const auto& line : lines ){
+      if ( converter ){
+	tokenizer.tokenizeLine( UnicodeString( line.c_str(),
+					       line.length(),
+					       "UTF-8" ) );
+      }
+      else {
+	tokenizer.tokenizeLine( line );
+      }
+      while ( true ){
+	vector<Token> sentence = tokenizer.popSentence();
+	if ( sentence.empty() ){
+	  break;
+	}
+	result.count += sentence.size();
+      }
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+Result convert_utf8( const vector<string>& lines,
+		     int repeat ){
+  // only decode every UTF-8 line to UTF-16 and encode it back. That is
+  // all a tokenizer working on UTF-8 could save, so compare it with
+  // tokenize_utf8()
+  Result result;
+  UnicodeString us;
+  string out;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    for ( const auto& line : lines ){
+      us = UnicodeString::fromUTF8( line );
+      out.clear();
+      us.toUTF8String( out );
+      result.count += out.size();
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+Result tokenize_batch( TokenizerClass& tokenizer,
+		       const vector<string>& texts,
+		       int repeat ){
+  // tokenize every text on its own with tokenizeBatch(), reusing the
+  // result, and count the sentences
+  Result result;
+  vector<vector<vector<Token>>> sentences;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    tokenizer.tokenizeBatch( texts, sentences );
+    for ( const auto& text : sentences ){
+      result.count += text.size();
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+class CountingSink: public SentenceSink {
+  // counts the sentences it gets
+public:
+  CountingSink(): count(0) {};
+  void sentence( const vector<Token>& ) { ++count; };
+  size_t count;
+};
+
+Result tokenize_sink( TokenizerClass& tokenizer,
+		      const string& file,
+		      int repeat ){
+  // tokenize the file to a SentenceSink and count the sentences
+  Result result;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    ifstream is( file );
+    CountingSink sink;
+    tokenizer.tokenize( is, sink );
+    result.count += sink.count;
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+void probe_bom( istream& is ){
+  // what ucto used to do before every sentence to find a BOM:
+  // read a word and seek back
+  streampos pos = is.tellg();
+  string s;
+  is >> s;
+  UErrorCode err = U_ZERO_ERROR;
+  int32_t bom_length = 0;
+  ucnv_detectUnicodeSignature( s.c_str(), s.length(), &bom_length, &err );
+  is.clear();
+  is.seekg( pos + (streampos)bom_length );
+}
+
+Result tokenize_stream( TokenizerClass& tokenizer,
+			const string& file,
+			int repeat,
+			bool probe ){
+  // tokenize the file with tokenizeOneSentence() and count the sentences
+  Result result;
+  size_t start_allocs = allocations;
+  auto start = chrono::steady_clock::now();
+  for ( int r=0; r < repeat; ++r ){
+    ifstream is( file );
+    while ( true ){
+      if ( probe ){
+	probe_bom( is );
+      }
+      vector<Token> sentence = tokenizer.tokenizeOneSentence( is );
+      if ( sentence.empty() ){
+	break;
+      }
+      ++result.count;
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  result.allocs = allocations - start_allocs;
+  result.secs = elapsed.count();
+  return result;
+}
+
+int main( int argc, char *argv[] ){
+  UErrorCode u_stat = U_ZERO_ERROR;
+  u_setMemoryFunctions( 0, icu_alloc, icu_realloc, icu_free, &u_stat );
+  if ( U_FAILURE(u_stat) ){
+    cerr << "unable to count ICU allocations: "
+	 << u_errorName( u_stat ) << endl;
+  }
+  string config;
+  string file;
+  int repeat = 1;
+  int cache_size = 0;
+  try {
+    TiCC::CL_Options Opts( "c:n:h", "cache-size:,help" );
+    Opts.init( argc, argv );
+    if ( Opts.extract( 'h' ) || Opts.extract( "help" ) ){
+      usage( argv[0] );
+      return EXIT_SUCCESS;
+    }
+    string value;
+    Opts.extract( 'c', config );
+    if ( Opts.extract( 'n', value ) ){
+      repeat = atoi( value.c_str() );
+    }
+    if ( Opts.extract( "cache-size", value ) ){
+      cache_size = atoi( value.c_str() );
+    }
+    vector<string> files = Opts.getMassOpts();
+    if ( config.empty() || files.size() != 1 || repeat < 1 || cache_size < 0 ){
+      usage( argv[0] );
+      return EXIT_FAILURE;
+    }
+    file = files[0];
+  }
+  catch ( const TiCC::OptionError& e ){
+    cerr << e.what() << endl;
+    usage( argv[0] );
+    return EXIT_FAILURE;
+  }
+  ifstream is( file );
+  if ( !is ){
+    cerr << "unable to open: " << file << endl;
+    return EXIT_FAILURE;
+  }
+  vector<string> raw_lines;
+  vector<UnicodeString> lines;
+  string line;
+  while ( getline( is, line ) ){
+    raw_lines.push_back( line );
+    lines.push_back( TiCC::UnicodeFromUTF8( line ) );
+  }
+  vector<UnicodeString> words = read_words( lines );
+
+  TiCC::LogStream log( cerr, "ucto_bench" );
+  Setting setting;
+  if ( !setting.read( config, "", 0, &log ) ){
+    cerr << "unable to read configuration: " << config << endl;
+    return EXIT_FAILURE;
+  }
+  RuleMatchers rules( setting.rules );
+  report( "rule matching, copies", "match",
+	  match_copies( rules, words, repeat ) );
+  report( "rule matching, spans ", "match",
+	  match_spans( rules, words, repeat ) );
+
+  TokenizerClass tokenizer;
+  tokenizer.setWordCacheSize( cache_size );
+  if ( !tokenizer.init( config ) ){
+    cerr << "unable to initialize the tokenizer with: " << config << endl;
+    return EXIT_FAILURE;
+  }
+  tokenizer.setSpanMatching( false );
+  tokenizer.setLetterPath( false );
+  report( "tokenizer, reference rule matching", "token",
+	  tokenize( tokenizer, lines, repeat ) );
+  tokenizer.setSpanMatching( true );
+  report( "tokenizer, span rule matching", "token",
+	  tokenize( tokenizer, lines, repeat ) );
+  tokenizer.setLetterPath( true );
+  report( "tokenizer, span rule matching, letter path", "token",
+	  tokenize( tokenizer, lines, repeat ) );
+  report( "tokenizer, UTF-8 lines, converter per line", "token",
+	  tokenize_utf8( tokenizer, raw_lines, repeat, true ) );
+  report( "tokenizer, UTF-8 lines, decoded directly", "token",
+	  tokenize_utf8( tokenizer, raw_lines, repeat, false ) );
+  report( "UTF-8 lines, only decoded and encoded again", "byte",
+	  convert_utf8( raw_lines, repeat ) );
+  report( "tokenizer, every line as a text of a batch", "sentence",
+	  tokenize_batch( tokenizer, raw_lines, repeat ) );
+  report( "tokenizer, stream, BOM probed per sentence", "sentence",
+	  tokenize_stream( tokenizer, file, repeat, true ) );
+  report( "tokenizer, stream, BOM found once", "sentence",
+	  tokenize_stream( tokenizer, file, repeat, false ) );
+  report( "tokenizer, stream, to a SentenceSink", "sentence",
+	  tokenize_sink( tokenizer, file, repeat ) );
+  return EXIT_SUCCESS;
+}